@@ -58,16 +58,18 @@ struct {
 int
 consolewrite(int user_src, uint64 src, int n)
 {
-  int i;
-
-  acquire(&cons.lock);
-  for(i = 0; i < n; i++){
-    char c;
-    if(either_copyin(&c, user_src, src+i, 1) == -1)
+  int i, j, m;
+  char buf[32];
+
+  // no cons.lock: touching the user's page may mean reading
+  // it in (see vmfault()), and uartputc() may sleep anyway.
+  for(i = 0; i < n; i += m){
+    m = n - i < sizeof(buf) ? n - i : sizeof(buf);
+    if(either_copyin(buf, user_src, src+i, m) == -1)
       break;
-    uartputc(c);
+    for(j = 0; j < m; j++)
+      uartputc(buf[j]);
   }
-  release(&cons.lock);
 
   return i;
 }
@@ -109,10 +111,16 @@ consoleread(int user_dst, uint64 dst, int n)
       break;
     }
 
-    // copy the input byte to the user-space buffer.
+    // copy the input byte to the user-space buffer,
+    // without cons.lock, since that may mean reading
+    // in the user's page (see vmfault()).
     cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
+    release(&cons.lock);
+    if(either_copyout(user_dst, dst, &cbuf, 1) == -1){
+      acquire(&cons.lock);
       break;
+    }
+    acquire(&cons.lock);
 
     dst++;
     --n;
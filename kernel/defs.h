@@ -8,6 +8,8 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct timepage;
+struct work;
 
 // bio.c
 void            binit(void);
@@ -24,6 +26,15 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execload(struct proc*, char*, char**);
+uint64          segpage(struct proc*, uint64, int*);
+void            textinit(void);
+void            textinval(struct inode*);
+
+// fdt.c
+extern uint64   fdtaddr;
+extern uint64   phystop;
+void            fdtinit(void);
 
 // file.c
 struct file*    filealloc(void);
@@ -62,6 +73,10 @@ void            ramdiskrw(struct buf*);
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
+void*           ksuperalloc(void);
+void            ksuperfree(void *);
+void            kdup(void *);
+int             krefs(void *);
 void            kinit(void);
 void            countMem(void*);  // Add
 
@@ -86,10 +101,17 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             spawn(char*, char**, int*, int);
+int             vfork(void);
+void            vfdone(struct proc*);
 int             growproc(int);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
+int             settickets(int);
+int             getticks(int);
+int             sched_setaffinity(int, uint);
+int             sched_getaffinity(int);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
@@ -99,23 +121,43 @@ void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+struct proc*    kthread_create(void (*)(void*), void*, char*);
+struct proc*    kthread_create_on_cpu(void (*)(void*), void*, char*, int);
+int             clone(uint64, uint64, int);
+int             join(int);
+void            mmstop(struct proc*);
+void            mmstart(struct proc*);
 int             wait(uint64);
 void            wakeup(void*);
+int             wakeupn(void*, int);
+void            makerunnable(struct proc*);
 void            yield(void);
+void            preempt(void);
+void            timeryield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
 
 void            countProc(void*); // Add
+void            asidinit(void);
+uint64          asidget(struct proc*);
+int             hasasids(void);
+uint64          proc_ksatp(struct proc*);
+void            proc_tlbinval(struct proc*, uint64, uint64);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// ucopy.S
+int             ucopy(void*, void*, uint64);
+int             ucopystr(char*, char*, uint64);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
+int             tryacquire(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
@@ -143,7 +185,12 @@ int             fetchaddr(uint64, uint64*);
 void            syscall();
 
 // trap.c
+void            ticksoff(void);
+void            tickson(void);
+int             nanosleep(uint64);
+uint64          uptimens(void);
 extern uint     ticks;
+extern struct timepage *timepage;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
@@ -159,9 +206,19 @@ int             uartgetc(void);
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+void            kvmswitch(uint64);
+pagetable_t     kvmcreate(void);
+void            kvmfree(pagetable_t);
+int             kvmmirror(pagetable_t, pagetable_t, uint64, uint64);
+void            kvmunmirror(pagetable_t, uint64, uint64);
 uint64          kvmpa(uint64);
 void            kvmmap(uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
+int             mapsuperpages(pagetable_t, uint64, uint64, uint64, int);
+pte_t*          walk(pagetable_t, uint64, int);
+pte_t*          walklevel(pagetable_t, uint64, int, int*);
+int             ptpages(pagetable_t);
+void            countKvm(void*);
 pagetable_t     uvmcreate(void);
 void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
@@ -170,11 +227,62 @@ int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+int             uvmsplit(pagetable_t, uint64);
+int             uvmsupercount(pagetable_t);
 uint64          walkaddr(pagetable_t, uint64);
+int             vmfault(struct proc*, uint64, int);
+uint64          uvmaddr(pagetable_t, uint64, int);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 
+// vma.c
+uint64          vmaalloc(struct proc*, uint64, int, int, struct file*, uint64);
+int             vmaunmap(struct proc*, uint64, uint64);
+void            vmaclear(struct proc*);
+uint64          vmabase(struct proc*);
+int             vmafault(struct proc*, uint64, int);
+int             vmapopulate(struct proc*);
+int             vmacopy(struct proc*, struct proc*);
+
+// swap.c
+void            swapinit(void);
+void            swapdup(pte_t);
+void            swapfree(pte_t);
+int             swapreclaim(int);
+int             swapin(struct proc*, uint64, pte_t*);
+void*           ukalloc(void);
+void            countSwap(void*);
+
+// zram.c
+void            zraminit(void);
+int             zstore(void*, int*);
+void            zdup(int);
+void            zfree(int);
+void            zload(int, void*);
+void            countZram(void*);
+
+// ksm.c
+void            ksminit(void);
+void            countKsm(void*);
+
+// futex.c
+void            futexinit(void);
+int             futexwait(uint64, int);
+int             futexwake(uint64, int);
+
+// workqueue.c
+void            workqueueinit(void);
+void            workqueueinithart(void);
+void            initwork(struct work*, void (*)(void*), void*);
+void            queue_work(int, struct work*);
+
+// vmcopyin.c
+int             copyout_new(pagetable_t, uint64, char *, uint64);
+int             copyin_new(pagetable_t, char *, uint64, uint64);
+int             copyinstr_new(pagetable_t, char *, uint64, uint64);
+uint64          uaccessfault(uint64);
+
 // plic.c
 void            plicinit(void);
 void            plicinithart(void);
@@ -184,6 +292,7 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_rwpage(uint, void *, int);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
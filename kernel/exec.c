@@ -3,23 +3,124 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "fs.h"
+#include "file.h"
 
-static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
+// the text cache: each inode that is a running program keeps
+// the pages of its read-only segments that have been read in,
+// so that every process running it can share them. ip->text
+// is a page of physical addresses indexed by file page number,
+// so only the first 2MB of a program file is cached.
+// textlock protects every inode's text; a page in the cache
+// holds one reference (see kdup()).
+struct spinlock textlock;
+
+void
+textinit(void)
+{
+  initlock(&textlock, "text");
+}
+
+// Return the cached page for ip's file offset off,
+// with a new reference to it, or 0.
+static uint64
+textget(struct inode *ip, uint64 off)
+{
+  uint64 pa = 0;
+
+  acquire(&textlock);
+  if(ip->text && off % PGSIZE == 0 && off / PGSIZE < 512)
+    pa = ip->text[off / PGSIZE];
+  if(pa)
+    kdup((void*)pa);
+  release(&textlock);
+  return pa;
+}
+
+// Cache pa as ip's page at file offset off, if there's room.
+// Caller must hold ip->lock, so that a write can't slip in
+// between reading the page and caching it.
+static void
+textput(struct inode *ip, uint64 off, uint64 pa)
+{
+  uint64 *text;
+
+  if(off % PGSIZE != 0 || off / PGSIZE >= 512)
+    return;
+  acquire(&textlock);
+  if(ip->text == 0 && (text = kalloc()) != 0){
+    memset(text, 0, PGSIZE);
+    ip->text = text;
+  }
+  if(ip->text && ip->text[off / PGSIZE] == 0){
+    kdup((void*)pa);
+    ip->text[off / PGSIZE] = pa;
+  }
+  release(&textlock);
+}
+
+// Drop ip's cached pages, because ip is being written or
+// truncated, or nothing refers to it any more. Processes
+// that have them mapped keep them.
+void
+textinval(struct inode *ip)
+{
+  uint64 *text;
+
+  acquire(&textlock);
+  text = ip->text;
+  ip->text = 0;
+  release(&textlock);
+
+  if(text == 0)
+    return;
+  for(int i = 0; i < 512; i++)
+    if(text[i])
+      kfree((void*)text[i]);
+  kfree(text);
+}
+
+static int
+flags2perm(int flags)
+{
+  int perm = PTE_R | PTE_U;
+
+  if(flags & ELF_PROG_FLAG_EXEC)
+    perm |= PTE_X;
+  if(flags & ELF_PROG_FLAG_WRITE)
+    perm |= PTE_W;
+  return perm;
+}
 
 int
 exec(char *path, char **argv)
+{
+  return execload(myproc(), path, argv);
+}
+
+// Replace p's memory with the program at path, to run with
+// argv. p is the current process, or for spawn(), a new one
+// that hasn't run yet. Returns argc, or -1.
+int
+execload(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
-  uint64 argc, sz = 0, sp, ustack[MAXARG+1], stackbase;
+  int i, off, borrowed;
+  uint64 argc, sz = 0, sp, ustack[MAXARG+1], stackbase, a, pa;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *execip = 0, *oldip;
   struct proghdr ph;
+  struct seg seg[NSEG];
+  int nseg = 0;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
+
+  // other threads would be left running in the old image.
+  if(p->group != p || p->nthread > 0)
+    return -1;
 
   begin_op();
 
@@ -38,7 +139,8 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record the program's segments; vmfault() will read
+  // them in a page at a time as the program touches them.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -48,20 +150,41 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz > MMAPTOP)
       goto bad;
-    sz = sz1;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(nseg == NSEG)
       goto bad;
+    seg[nseg].va = ph.vaddr;
+    seg[nseg].off = ph.off;
+    seg[nseg].filesz = ph.filesz;
+    seg[nseg].memsz = ph.memsz;
+    seg[nseg].perm = flags2perm(ph.flags);
+    nseg++;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
+  execip = idup(ip);
   iunlockput(ip);
   end_op();
   ip = 0;
 
-  p = myproc();
+  // Map the read-only pages that other processes running
+  // this program have already read in.
+  for(i = 0; i < nseg; i++){
+    if(seg[i].perm & PTE_W)
+      continue;
+    for(a = 0; a < seg[i].memsz; a += PGSIZE){
+      if((pa = textget(execip, seg[i].off + a)) == 0)
+        continue;
+      if(mappages(pagetable, seg[i].va + a, PGSIZE, pa, seg[i].perm) != 0){
+        kfree((void*)pa);
+        goto bad;
+      }
+    }
+  }
+
   uint64 oldsz = p->sz;
 
   // Allocate two pages at the next page boundary.
@@ -109,12 +232,30 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  vmaclear(p);
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
   p->sz = sz;
+  oldip = p->execip;
+  p->execip = execip;
+  memmove(p->seg, seg, sizeof(seg));
+  p->nseg = nseg;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+  // a vfork() child gives the parent its memory back.
+  borrowed = p->vfparent != 0;
+  if(borrowed)
+    vfdone(p);
+  proc_tlbinval(p, 0, PGROUNDUP(oldsz) / PGSIZE);
+  p->asidgen = 0;   // the old page-table pages are going
+  kvmmirror(p->kpagetable, pagetable, 0, sz);
+  if(!borrowed)
+    proc_freepagetable(oldpagetable, oldsz);
+  if(oldip){
+    begin_op();
+    iput(oldip);
+    end_op();
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -125,33 +266,71 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(execip){
+    begin_op();
+    iput(execip);
+    end_op();
+  }
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+// Return a page holding what p's program has at user address
+// va, which isn't mapped yet, for vmfault(), and set *perm to
+// the permissions to map it with. A page that lies in just one
+// segment, a read-only one, comes from the text cache if it
+// can, and goes into it otherwise; other pages are private.
+// Memory past the segments' filesz is zero-filled.
+// Returns 0 if out of memory or the file can't be read.
+uint64
+segpage(struct proc *p, uint64 va, int *perm)
 {
-  uint i, n;
-  uint64 pa;
-
-  if((va % PGSIZE) != 0)
-    panic("loadseg: va must be page aligned");
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
+  struct proc *g = p->group;
+  struct inode *ip = g->execip;
+  struct seg *s, *only = 0;
+  uint64 lo, hi, off = 0;
+  char *mem;
+  int n = 0, locked = 0, shared, ok = 1;
+
+  *perm = 0;
+  for(s = g->seg; s < &g->seg[g->nseg]; s++){
+    if(va + PGSIZE > s->va && va < s->va + s->memsz){
+      *perm |= s->perm;
+      only = s;
+      n++;
+    }
+  }
+  if(n == 0)
+    *perm = PTE_W|PTE_X|PTE_R|PTE_U;  // a gap between segments.
+  shared = (n == 1 && (only->perm & PTE_W) == 0);
+  if(shared){
+    off = only->off + (va - only->va);
+    if((mem = (char*)textget(ip, off)) != 0)
+      return (uint64)mem;
+  }
+
+  if((mem = ukalloc()) == 0)
+    return 0;
+  memset(mem, 0, PGSIZE);
+  // a write() into the program file itself may be what
+  // faulted, in which case we already hold ip's lock, and
+  // the page mustn't be cached.
+  if(ip && !holdingsleep(&ip->lock)){
+    ilock(ip);
+    locked = 1;
+  }
+  for(s = g->seg; s < &g->seg[g->nseg] && ok; s++){
+    lo = va > s->va ? va : s->va;
+    hi = va + PGSIZE < s->va + s->filesz ? va + PGSIZE : s->va + s->filesz;
+    if(lo < hi && readi(ip, 0, (uint64)mem + (lo - va), s->off + (lo - s->va), hi - lo) != hi - lo)
+      ok = 0;
+  }
+  if(ok && shared && locked)
+    textput(ip, off, (uint64)mem);
+  if(locked)
+    iunlock(ip);
+  if(!ok){
+    kfree(mem);
+    return 0;
   }
-  
-  return 0;
+  return (uint64)mem;
 }
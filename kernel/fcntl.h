@@ -3,3 +3,24 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+
+// mmap() prot
+#define PROT_NONE  0x0
+#define PROT_READ  0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC  0x4
+
+// mmap() flags
+#define MAP_SHARED    0x01
+#define MAP_PRIVATE   0x02
+#define MAP_ANONYMOUS 0x04
+
+#define MAP_FAILED ((void *) -1)
+
+// clone() flags; both are required.
+#define CLONE_VM    0x01  // share memory
+#define CLONE_FILES 0x02  // share open files
+
+// futex() ops
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
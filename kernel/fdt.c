@@ -0,0 +1,147 @@
+//
+// minimal flattened device tree (FDT) reader.
+// qemu passes the address of the device tree blob in a1
+// when it jumps to _entry; entry.S and start() save it in
+// fdtaddr. fdtinit() runs before kinit() and looks for the
+// memory node, so that the page allocator and the kernel's
+// direct map cover all of the RAM qemu was given (-m).
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define FDT_MAGIC      0xd00dfeed
+#define FDT_BEGIN_NODE 1
+#define FDT_END_NODE   2
+#define FDT_PROP       3
+#define FDT_NOP        4
+#define FDT_END        9
+
+// header at the start of the blob; all fields are big-endian.
+struct fdthdr {
+  uint32 magic;
+  uint32 totalsize;
+  uint32 off_dt_struct;
+  uint32 off_dt_strings;
+  uint32 off_mem_rsvmap;
+  uint32 version;
+  uint32 last_comp_version;
+  uint32 boot_cpuid_phys;
+  uint32 size_dt_strings;
+  uint32 size_dt_struct;
+};
+
+uint64 fdtaddr;   // physical address of the blob, set by start().
+uint64 phystop;   // end of usable RAM; see PHYSTOP in memlayout.h.
+
+static uint32
+be32(void *p)
+{
+  uchar *b = p;
+  return ((uint32)b[0] << 24) | ((uint32)b[1] << 16) | ((uint32)b[2] << 8) | b[3];
+}
+
+// read a value of ncells 32-bit cells, most significant first.
+static uint64
+cells(uchar *p, int ncells)
+{
+  uint64 x = 0;
+  for(int i = 0; i < ncells; i++)
+    x = (x << 32) | be32(p + 4*i);
+  return x;
+}
+
+static int
+prefix(char *s, char *pre)
+{
+  while(*pre)
+    if(*s++ != *pre++)
+      return 0;
+  return 1;
+}
+
+// Scan the device tree for the memory node that contains
+// KERNBASE and return the end of that region, or 0 if the
+// blob is missing or malformed.
+static uint64
+fdtmemtop(uchar *fdt)
+{
+  struct fdthdr *h = (struct fdthdr *)fdt;
+  uchar *p, *end;
+  char *strings, *name;
+  int depth = 0, inmem = 0;
+  int acells = 2, scells = 1;
+  uint32 tok, len;
+
+  if(be32(&h->magic) != FDT_MAGIC)
+    return 0;
+
+  p = fdt + be32(&h->off_dt_struct);
+  end = p + be32(&h->size_dt_struct);
+  strings = (char *)fdt + be32(&h->off_dt_strings);
+
+  while(p < end){
+    tok = be32(p);
+    p += 4;
+    switch(tok){
+    case FDT_BEGIN_NODE:
+      name = (char *)p;
+      depth++;
+      // memory nodes are direct children of the root.
+      inmem = (depth == 2 && prefix(name, "memory"));
+      p += (strlen(name) + 1 + 3) & ~3;
+      break;
+    case FDT_END_NODE:
+      depth--;
+      inmem = 0;
+      break;
+    case FDT_PROP:
+      len = be32(p);
+      name = strings + be32(p + 4);
+      p += 8;
+      if(depth == 1 && strncmp(name, "#address-cells", 15) == 0){
+        acells = be32(p);
+      } else if(depth == 1 && strncmp(name, "#size-cells", 12) == 0){
+        scells = be32(p);
+      } else if(inmem && strncmp(name, "reg", 4) == 0){
+        // reg is a list of (base, size) pairs.
+        uint stride = 4 * (acells + scells);
+        for(uint off = 0; stride > 0 && off + stride <= len; off += stride){
+          uint64 base = cells(p + off, acells);
+          uint64 size = cells(p + off + 4*acells, scells);
+          if(base <= KERNBASE && KERNBASE < base + size)
+            return base + size;
+        }
+      }
+      p += (len + 3) & ~3;
+      break;
+    case FDT_NOP:
+      break;
+    case FDT_END:
+    default:
+      return 0;
+    }
+  }
+  return 0;
+}
+
+// Set phystop from the device tree qemu handed us, falling
+// back to the compiled-in MEMMB if there isn't one.
+// Must run before kinit(), since the blob usually sits in
+// RAM that kinit() is about to hand to the page allocator.
+void
+fdtinit(void)
+{
+  uint64 top = 0;
+
+  if(fdtaddr)
+    top = fdtmemtop((uchar *)fdtaddr);
+  if(top == 0)
+    top = KERNBASE + (uint64)MEMMB*1024*1024;
+  if(top > MAXPHYS)
+    top = MAXPHYS;
+  phystop = PGROUNDDOWN(top);
+}
@@ -15,8 +15,8 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
-#include "proc.h"
 #include "sleeplock.h"
+#include "proc.h"
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
@@ -44,6 +44,7 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  swapinit();
 }
 
 // Zero a block.
@@ -354,6 +355,8 @@ iput(struct inode *ip)
   }
 
   ip->ref--;
+  if(ip->ref == 0)
+    textinval(ip);
   release(&icache.lock);
 }
 
@@ -413,6 +416,7 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  textinval(ip);
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -490,6 +494,10 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  // cached program pages may be about to go stale.
+  if(ip->text)
+    textinval(ip);
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
@@ -0,0 +1,87 @@
+//
+// futexes: sleeping until a word of user memory changes.
+//
+// futex(addr, FUTEX_WAIT, val) sleeps if the int at addr is
+// still val, and futex(addr, FUTEX_WAKE, n) wakes up to n
+// sleepers on addr. a sleeper sleeps on the physical address
+// of the word, so that threads, or processes sharing the page
+// through MAP_SHARED, meet there whatever their virtual
+// addresses. the check and the sleep happen under futex.lock,
+// which wakers take too, so no wake can come in between.
+//
+// the page is made private first, in case ksm.c merged it.
+// it isn't swapped out while someone sleeps on it, since
+// swap.c leaves alone both processes with threads and mmap()
+// regions.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+
+struct {
+  struct spinlock lock;
+} futex;
+
+void
+futexinit(void)
+{
+  initlock(&futex.lock, "futex");
+}
+
+// The physical address of the current process's int at addr,
+// with interrupts off (see uvmaddr()), or 0.
+static uint64
+futexaddr(uint64 addr)
+{
+  uint64 pa;
+
+  if(addr % sizeof(int) != 0)
+    return 0;
+  if((pa = uvmaddr(myproc()->pagetable, addr, 1)) == 0)
+    return 0;
+  return pa + addr % PGSIZE;
+}
+
+// Sleep until woken, if the int at addr is val.
+// Returns 0 if woken, -1 if it wasn't val or if killed.
+int
+futexwait(uint64 addr, int val)
+{
+  struct proc *p = myproc();
+  uint64 pa;
+
+  if((pa = futexaddr(addr)) == 0)
+    return -1;
+  acquire(&futex.lock);
+  pop_off();
+  if(*(volatile int*)pa != val || p->killed){
+    release(&futex.lock);
+    return -1;
+  }
+  sleep((void*)pa, &futex.lock);
+  release(&futex.lock);
+  return p->killed ? -1 : 0;
+}
+
+// Wake up to n processes sleeping on addr.
+// Returns how many it woke.
+int
+futexwake(uint64 addr, int n)
+{
+  uint64 pa;
+  int woke;
+
+  if((pa = futexaddr(addr)) == 0)
+    return -1;
+  acquire(&futex.lock);
+  pop_off();
+  woke = wakeupn((void*)pa, n);
+  release(&futex.lock);
+  return woke;
+}
@@ -1,6 +1,16 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// and 2MB-aligned superpages for large user heaps.
+//
+// Free memory is kept as a list of free superpages and a
+// list of free pages. kalloc() breaks up a superpage when
+// it runs out of pages; ksuperalloc() gathers runs of 512
+// free pages back into superpages when it runs out.
+//
+// A page can be mapped by more than one page table (shared
+// program text, for example); kdup() counts the extra
+// references, and kfree() only frees on the last one.
 
 #include "types.h"
 #include "param.h"
@@ -19,16 +29,32 @@ struct run {
   struct run *next;
 };
 
+#define NCHUNK ((MAXPHYS - KERNBASE) / SPGSIZE)
+#define CHUNK(pa) (((uint64)(pa) - KERNBASE) / SPGSIZE)
+#define PAGE(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
 struct {
   struct spinlock lock;
   struct run *freelist;
+  struct run *superlist;  // free superpages
+  int nfreed;             // pages freed since the last kcoalesce()
+  ushort nfree[NCHUNK];   // scratch for kcoalesce()
+  ushort *ref;            // references to each allocated page
 } kmem;
 
+static void kcoalesce(void);
+
 void
 kinit()
 {
+  uint64 n = (PHYSTOP - KERNBASE) / PGSIZE;
+
   initlock(&kmem.lock, "kmem");
-  freerange(end, (void*)PHYSTOP);
+  // the reference counts go just after the kernel,
+  // sized for however much RAM there is.
+  kmem.ref = (ushort*)PGROUNDUP((uint64)end);
+  memset(kmem.ref, 0, n * sizeof(ushort));
+  freerange(kmem.ref + n, (void*)PHYSTOP);
 }
 
 void
@@ -36,8 +62,14 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    if((uint64)p % SPGSIZE == 0 && p + SPGSIZE <= (char*)pa_end){
+      ksuperfree(p);
+      p += SPGSIZE - PGSIZE;
+    } else {
+      kfree(p);
+    }
+  }
 }
 
 // Free the page of physical memory pointed at by v,
@@ -52,6 +84,16 @@ kfree(void *pa)
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  acquire(&kmem.lock);
+  if(kmem.ref[PAGE(pa)] > 1){
+    // someone else still has it.
+    kmem.ref[PAGE(pa)]--;
+    release(&kmem.lock);
+    return;
+  }
+  kmem.ref[PAGE(pa)] = 0;
+  release(&kmem.lock);
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
@@ -60,6 +102,30 @@ kfree(void *pa)
   acquire(&kmem.lock);
   r->next = kmem.freelist;
   kmem.freelist = r;
+  kmem.nfreed++;
+  release(&kmem.lock);
+}
+
+// Free a superpage, which normally should have been
+// returned by ksuperalloc().
+void
+ksuperfree(void *pa)
+{
+  struct run *r;
+
+  if(((uint64)pa % SPGSIZE) != 0 || (char*)pa < end || (uint64)pa + SPGSIZE > PHYSTOP)
+    panic("ksuperfree");
+
+  // Fill with junk to catch dangling refs.
+  memset(pa, 1, SPGSIZE);
+
+  r = (struct run*)pa;
+
+  acquire(&kmem.lock);
+  for(int i = 0; i < 512; i++)
+    kmem.ref[PAGE(r) + i] = 0;
+  r->next = kmem.superlist;
+  kmem.superlist = r;
   release(&kmem.lock);
 }
 
@@ -69,12 +135,23 @@ kfree(void *pa)
 void *
 kalloc(void)
 {
-  struct run *r;
+  struct run *r, *s;
 
   acquire(&kmem.lock);
+  if(kmem.freelist == 0 && (s = kmem.superlist) != 0){
+    // out of pages; break up a superpage.
+    kmem.superlist = s->next;
+    for(int i = 512 - 1; i >= 0; i--){
+      r = (struct run*)((char*)s + i*PGSIZE);
+      r->next = kmem.freelist;
+      kmem.freelist = r;
+    }
+  }
   r = kmem.freelist;
-  if(r)
+  if(r){
     kmem.freelist = r->next;
+    kmem.ref[PAGE(r)] = 1;
+  }
   release(&kmem.lock);
 
   if(r)
@@ -82,6 +159,87 @@ kalloc(void)
   return (void*)r;
 }
 
+// Add a reference to a page returned by kalloc(), so that
+// it takes one more kfree() to free it.
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+
+  acquire(&kmem.lock);
+  if(kmem.ref[PAGE(pa)] == 0 || kmem.ref[PAGE(pa)] == 0xFFFF)
+    panic("kdup: ref");
+  kmem.ref[PAGE(pa)]++;
+  release(&kmem.lock);
+}
+
+// Return the number of references to an allocated page.
+int
+krefs(void *pa)
+{
+  return kmem.ref[PAGE(pa)];
+}
+
+// Allocate one 2MB-aligned superpage of physical memory.
+// Returns 0 if there is no free superpage, even though
+// there may be plenty of free (but scattered) pages.
+void *
+ksuperalloc(void)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  // re-assembling superpages means looking at every free
+  // page, so only try once enough has been freed to matter.
+  if(kmem.superlist == 0 && kmem.nfreed >= 512)
+    kcoalesce();
+  r = kmem.superlist;
+  if(r){
+    kmem.superlist = r->next;
+    // its pages may later be split up and freed one by one.
+    for(int i = 0; i < 512; i++)
+      kmem.ref[PAGE(r) + i] = 1;
+  }
+  release(&kmem.lock);
+
+  if(r)
+    memset((char*)r, 5, SPGSIZE); // fill with junk
+  return (void*)r;
+}
+
+// Move every superpage-sized run of free pages from the
+// page list to the superpage list.
+// Caller must hold kmem.lock.
+static void
+kcoalesce(void)
+{
+  struct run *r, **pp;
+  uint64 c;
+
+  kmem.nfreed = 0;
+  memset(kmem.nfree, 0, sizeof(kmem.nfree));
+  for(r = kmem.freelist; r; r = r->next)
+    kmem.nfree[CHUNK(r)]++;
+
+  // unlink the pages of every chunk that is entirely free.
+  pp = &kmem.freelist;
+  while((r = *pp) != 0){
+    if(kmem.nfree[CHUNK(r)] == 512)
+      *pp = r->next;
+    else
+      pp = &r->next;
+  }
+
+  for(c = 0; c < NCHUNK; c++){
+    if(kmem.nfree[c] == 512){
+      r = (struct run*)(KERNBASE + c*SPGSIZE);
+      r->next = kmem.superlist;
+      kmem.superlist = r;
+    }
+  }
+}
+
 void countMem(void* ptr) {
   struct sysinfo* inf = (struct sysinfo*)ptr;
   acquire(&kmem.lock);
@@ -90,5 +248,7 @@ void countMem(void* ptr) {
     inf->freemem += PGSIZE;
     r = r->next;
   }
+  for(r = kmem.superlist; r; r = r->next)
+    inf->freemem += SPGSIZE;
   release(&kmem.lock);
 }
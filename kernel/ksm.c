@@ -0,0 +1,270 @@
+//
+// kernel same-page merging.
+//
+// the ksmd kernel process wakes up every KSMTICKS and runs
+// a hand over KSMBATCH pages of user memory, the way the swap
+// hand does (see swap.c). it hashes each writable page that
+// no other page table shares, and looks for a page with the
+// same contents among the stable frames it has merged pages
+// into before. if there is one, the page's PTE is pointed at
+// it, read-only and with PTE_COW, and the page is freed; a
+// store to it faults, and vmfault() gives the process its own
+// copy again. if not, but a page with the same hash turned up
+// earlier in this pass, the page is copied into a new stable
+// frame and merged into that; the earlier page will find it
+// on the next pass.
+//
+// a page that has been written since the hand last came by,
+// which PTE_D says, is likely to be written again, so the
+// hand clears PTE_D and leaves it alone for now.
+//
+// the table holds a reference to each stable frame, so a
+// frame with one reference maps no page, and the end of each
+// pass frees those.
+//
+// like the swap hand, this one only changes the PTEs of a
+// process that isn't running, and has no threads or vfork()
+// child, while holding its p->lock.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "sysinfo.h"
+#include "defs.h"
+
+#define KSMBATCH  64        // pages looked at per wakeup
+#define KSMTICKS  1         // between wakeups
+#define NKSM      512       // stable table slots; at most half used
+#define NSEEN     1024      // hashes of the current pass; ditto
+#define KSMMAXREF 1024      // pages merged into one frame
+
+extern struct proc *allproc;
+
+struct ksmframe {
+  uint64 hash;              // 0 if the slot is free
+  char *pa;
+};
+
+struct {
+  struct spinlock lock;
+  struct ksmframe stable[NKSM];
+  int nstable;
+  struct ksmframe old[NKSM];  // ksmprune()'s copy of stable
+  uint64 seen[NSEEN];       // hashes seen this pass, 0 if free
+  int nseen;
+  struct proc *proc;        // the hand: 0 means allproc's head
+  uint64 va;
+} ksm;
+
+static void ksmd(void*);
+
+// Called by main() once there is a first process.
+void
+ksminit(void)
+{
+  initlock(&ksm.lock, "ksm");
+  if(kthread_create(ksmd, 0, "ksmd") == 0)
+    panic("ksminit");
+}
+
+// FNV-1a, a word at a time; never 0.
+static uint64
+ksmhash(uint64 *w)
+{
+  uint64 h = 0xcbf29ce484222325;
+  int i;
+
+  for(i = 0; i < PGSIZE / sizeof(uint64); i++){
+    h ^= w[i];
+    h *= 0x100000001b3;
+  }
+  return h ? h : 1;
+}
+
+// Find a stable frame with the same contents as the page at
+// pa that has room for another page, or return 0.
+// Caller must hold ksm.lock.
+static char*
+ksmlookup(uint64 hash, char *pa)
+{
+  struct ksmframe *k;
+  int i;
+
+  for(i = hash % NKSM; (k = &ksm.stable[i])->hash; i = (i + 1) % NKSM)
+    if(k->hash == hash && krefs(k->pa) < KSMMAXREF &&
+       memcmp(k->pa, pa, PGSIZE) == 0)
+      return k->pa;
+  return 0;
+}
+
+// Caller must hold ksm.lock, and make sure there's room.
+static void
+ksminsert(uint64 hash, char *f)
+{
+  int i;
+
+  for(i = hash % NKSM; ksm.stable[i].hash; i = (i + 1) % NKSM)
+    ;
+  ksm.stable[i].hash = hash;
+  ksm.stable[i].pa = f;
+  ksm.nstable++;
+}
+
+// Note hash as seen this pass. Returns 1 if it already was.
+// Caller must hold ksm.lock.
+static int
+ksmseen(uint64 hash)
+{
+  int i;
+
+  for(i = hash % NSEEN; ksm.seen[i]; i = (i + 1) % NSEEN)
+    if(ksm.seen[i] == hash)
+      return 1;
+  if(ksm.nseen < NSEEN / 2){
+    ksm.seen[i] = hash;
+    ksm.nseen++;
+  }
+  return 0;
+}
+
+// Point p's PTE for va at the stable frame f, and free the
+// page it mapped.
+static void
+ksmmerge(struct proc *p, uint64 va, pte_t *pte, char *f)
+{
+  char *pa = (char*)PTE2PA(*pte);
+
+  kdup(f);
+  *pte = PA2PTE(f) | (PTE_FLAGS(*pte) & ~(PTE_W|PTE_D)) | PTE_COW;
+  proc_tlbinval(p, va, 1);
+  kfree(pa);
+}
+
+// Look at p's page at va, whose PTE is pte.
+// Caller must hold p->lock and ksm.lock.
+static void
+ksmpage(struct proc *p, uint64 va, pte_t *pte)
+{
+  uint64 hash;
+  char *pa, *f;
+
+  if((*pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U|PTE_W))
+    return;
+  pa = (char*)PTE2PA(*pte);
+  if(krefs(pa) != 1)
+    return;
+  if(*pte & PTE_D){
+    // written since the hand last came by.
+    *pte &= ~PTE_D;
+    proc_tlbinval(p, va, 1);
+    return;
+  }
+
+  hash = ksmhash((uint64*)pa);
+  if((f = ksmlookup(hash, pa)) != 0){
+    ksmmerge(p, va, pte, f);
+  } else if(ksmseen(hash) && ksm.nstable < NKSM / 2 && (f = kalloc()) != 0){
+    memmove(f, pa, PGSIZE);
+    ksminsert(hash, f);
+    ksmmerge(p, va, pte, f);
+  }
+}
+
+// At the end of a pass, free the stable frames no page maps
+// any more, and forget the hashes seen.
+// Caller must hold ksm.lock.
+static void
+ksmprune(void)
+{
+  struct ksmframe *old = ksm.old;
+  int i;
+
+  memmove(old, ksm.stable, sizeof(ksm.old));
+  memset(ksm.stable, 0, sizeof(ksm.stable));
+  ksm.nstable = 0;
+  for(i = 0; i < NKSM; i++){
+    if(old[i].hash == 0)
+      continue;
+    if(krefs(old[i].pa) == 1)
+      kfree(old[i].pa);
+    else
+      ksminsert(old[i].hash, old[i].pa);
+  }
+  memset(ksm.seen, 0, sizeof(ksm.seen));
+  ksm.nseen = 0;
+}
+
+// Advance the hand over up to n pages, or to the end of the
+// pass, whichever comes first.
+static void
+ksmscan(int n)
+{
+  struct proc *p;
+  pte_t *pte;
+  uint64 va;
+  int level;
+
+  acquire(&ksm.lock);
+  while(n > 0){
+    if(ksm.proc == 0)
+      ksm.proc = allproc;
+    p = ksm.proc;
+    acquire(&p->lock);
+    if(p->pagetable == 0 || p->group != p || p->nthread > 0 ||
+       p->vfparent || p->vfchild || p->forking ||
+       (p->state != SLEEPING && p->state != RUNNABLE))
+      ksm.va = p->sz;
+    for(; n > 0 && ksm.va < p->sz; ksm.va += PGSIZE){
+      va = ksm.va;
+      level = 0;
+      if((pte = walklevel(p->pagetable, va, 0, &level)) == 0 || level > 0){
+        // nothing mapped here, or a superpage; skip it.
+        ksm.va = SPGROUNDDOWN(va) + SPGSIZE - PGSIZE;
+        continue;
+      }
+      ksmpage(p, va, pte);
+      n--;
+    }
+    if(ksm.va >= p->sz){
+      ksm.va = 0;
+      if((ksm.proc = p->allnext) == 0){
+        ksmprune();
+        n = 0;
+      }
+    }
+    release(&p->lock);
+  }
+  release(&ksm.lock);
+}
+
+static void
+ksmd(void *arg)
+{
+  uint t0;
+
+  for(;;){
+    ksmscan(KSMBATCH);
+    acquire(&tickslock);
+    t0 = ticks;
+    while(ticks - t0 < KSMTICKS)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+  }
+}
+
+void countKsm(void* ptr) {
+  struct sysinfo* inf = (struct sysinfo*)ptr;
+  int i;
+
+  inf->nksm = 0;
+  acquire(&ksm.lock);
+  for(i = 0; i < NKSM; i++)
+    if(ksm.stable[i].hash && krefs(ksm.stable[i].pa) > 2)
+      inf->nksm += krefs(ksm.stable[i].pa) - 2;
+  release(&ksm.lock);
+}
@@ -6,6 +6,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "workqueue.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -20,6 +21,11 @@
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
+// With make LOGASYNC=1, the last end_op() doesn't commit
+// itself, but queues the commit for a worker, so that its
+// system call can return while the log is written; the next
+// begin_op() waits for it. The call's changes may then be
+// lost in a crash after it returns, so this is off by default.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -44,12 +50,14 @@ struct log {
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
   int dev;
+  struct work commitwork;
   struct logheader lh;
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void commitwork(void*);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -61,6 +69,7 @@ initlog(int dev, struct superblock *sb)
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
+  initwork(&log.commitwork, commitwork, 0);
   recover_from_log();
 }
 
@@ -163,16 +172,26 @@ end_op(void)
   release(&log.lock);
 
   if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+#ifdef LOGASYNC
+    queue_work(WQ_NORMAL, &log.commitwork);
+#else
+    commitwork(0);
+#endif
   }
 }
 
+// Commit for the end_op() that set committing, on a worker
+// if LOGASYNC.
+static void
+commitwork(void *arg)
+{
+  commit();
+  acquire(&log.lock);
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
+}
+
 // Copy modified blocks from cache to log.
 static void
 write_log(void)
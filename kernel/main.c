@@ -16,19 +16,26 @@ main()
     printf("\n");
     printf("xv6 kernel is booting\n");
     printf("\n");
+    fdtinit();       // find out how much RAM there is
     kinit();         // physical page allocator
+    zraminit();      // compressed page store
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
+    workqueueinit(); // deferred work
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode cache
+    textinit();      // program text cache
     fileinit();      // file table
+    futexinit();     // futex wait queue
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
+    ksminit();       // same-page merging thread
+    workqueueinithart(); // this hart's workers
     __sync_synchronize();
     started = 1;
   } else {
@@ -39,6 +46,7 @@ main()
     kvminithart();    // turn on paging
     trapinithart();   // install kernel trap vector
     plicinithart();   // ask PLIC for device interrupts
+    workqueueinithart(); // this hart's workers
   }
 
   scheduler();        
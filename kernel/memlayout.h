@@ -4,6 +4,7 @@
 // based on qemu's hw/riscv/virt.c:
 //
 // 00001000 -- boot ROM, provided by qemu
+// 00101000 -- goldfish RTC
 // 02000000 -- CLINT
 // 0C000000 -- PLIC
 // 10000000 -- uart0 
@@ -15,7 +16,13 @@
 // the kernel uses physical memory thus:
 // 80000000 -- entry.S, then kernel text and data
 // end -- start of kernel page allocation area
-// PHYSTOP -- end RAM used by the kernel
+// PHYSTOP -- end RAM used by the kernel, found at boot
+//            from the device tree (see fdt.c)
+
+// qemu's real-time clock: ns since 1970, read TIME_LOW first.
+#define RTC0 0x00101000L
+#define RTC0_TIME_LOW (RTC0 + 0x0)
+#define RTC0_TIME_HIGH (RTC0 + 0x4)
 
 // qemu puts UART registers here in physical memory.
 #define UART0 0x10000000L
@@ -27,8 +34,11 @@
 
 // local interrupt controller, which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid))
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
+#define TIMEBASE 10000000L // CLINT_MTIME cycles per second in qemu.
+#define TICKCYCLES (TIMEBASE / 1000000 * TICKUS)
 
 // qemu puts programmable interrupt controller here.
 #define PLIC 0x0c000000L
@@ -41,11 +51,22 @@
 #define PLIC_MCLAIM(hart) (PLIC + 0x200004 + (hart)*0x2000)
 #define PLIC_SCLAIM(hart) (PLIC + 0x201004 + (hart)*0x2000)
 
+// the kernel maps the CLINT here rather than at CLINT, above
+// PLIC, where the process kernel page tables have it too
+// (see kvmcreate()), for kickidle() and the idle timer.
+#define KCLINT 0x0e000000L
+#define KCLINT_MSIP(hartid) (KCLINT + 4*(hartid))
+#define KCLINT_MTIMECMP(hartid) (KCLINT + 0x4000 + 8*(hartid))
+#define KCLINT_MTIME (KCLINT + 0xBFF8)
+
 // the kernel expects there to be RAM
 // for use by the kernel and user pages
 // from physical address 0x80000000 to PHYSTOP.
+// PHYSTOP is however much RAM qemu was started with (-m),
+// but the kernel direct-maps no more than MAXPHYS.
 #define KERNBASE 0x80000000L
-#define PHYSTOP (KERNBASE + 128*1024*1024)
+#define MAXPHYS (KERNBASE + 4L*1024*1024*1024)
+#define PHYSTOP phystop
 
 // map the trampoline page to the highest address,
 // in both user and kernel space.
@@ -53,6 +74,7 @@
 
 // map kernel stacks beneath the trampoline,
 // each surrounded by invalid guard pages.
+// a proc's is mapped by allocproc() and unmapped by freeproc().
 #define KSTACK(p) (TRAMPOLINE - ((p)+1)* 2*PGSIZE)
 
 // User memory layout.
@@ -62,6 +84,12 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   mmap() regions, allocated downward from MMAPTOP
+//   TIMEPAGE (read-only, shared by all; see timepage.h)
+//   the trapframes of threads made by clone(), downward
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define THREADTRAPFRAME(slot) (TRAPFRAME - (slot)*PGSIZE)
+#define TIMEPAGE THREADTRAPFRAME(NTHREAD)
+#define MMAPTOP TIMEPAGE
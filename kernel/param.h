@@ -1,13 +1,27 @@
-#define NPROC        64  // maximum number of processes
+#ifndef MEMMB
+#define MEMMB       128  // MB of RAM the kernel is sized for (make MEM=)
+#endif
+#define MEMSCALE     (MEMMB < 256 ? 1 : MEMMB < 2048 ? MEMMB/128 : 16)
+#define NPROC        (4096*MEMSCALE)  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NFILE        (100*MEMSCALE)  // open files per system
+#define NINODE       (50*MEMSCALE)  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define NSEG          4  // max loadable ELF segments per program
+#define NVMA         16  // max mmap() regions per process
+#define NTHREAD      16  // max threads per process, counting the first
+#define NMLFQ         3  // MLFQ scheduler queues (make SCHED=MLFQ)
+#define MLFQBOOST    10  // ticks between moves of everything to queue 0
+#define NTICKETS    100  // a new process's stride scheduler tickets
+#ifndef TICKUS
+#define TICKUS   100000  // microseconds per timer tick and time slice (make TICK=)
+#endif
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define NBUF         (MAXOPBLOCKS*3*MEMSCALE)  // size of disk block cache
+#define FSSIZE       2000  // size of file system in blocks
+#define SWAPSIZE     16384  // size of swap area in blocks, after the file system
 #define MAXPATH      128   // maximum file path name
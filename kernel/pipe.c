@@ -3,15 +3,16 @@
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "fs.h"
-#include "sleeplock.h"
 #include "file.h"
 
 #define PIPESIZE 512
 
 struct pipe {
   struct spinlock lock;
+  struct sleeplock rlock;  // one reader at a time; see piperead()
   char data[PIPESIZE];
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
@@ -35,6 +36,7 @@ pipealloc(struct file **f0, struct file **f1)
   pi->nwrite = 0;
   pi->nread = 0;
   initlock(&pi->lock, "pipe");
+  initsleeplock(&pi->rlock, "pipereader");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -73,55 +75,76 @@ pipeclose(struct pipe *pi, int writable)
     release(&pi->lock);
 }
 
+// the user's buffer is copied through buf, outside pi->lock,
+// since touching it may mean reading in a page (see vmfault()).
+#define PIPECHUNK 128
+
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
-  char ch;
+  int i, j, m;
+  char buf[PIPECHUNK];
   struct proc *pr = myproc();
 
-  acquire(&pi->lock);
-  for(i = 0; i < n; i++){
-    while(pi->nwrite == pi->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(pi->readopen == 0 || pr->killed){
-        release(&pi->lock);
-        return -1;
+  for(i = 0; i < n; i += m){
+    m = n - i < PIPECHUNK ? n - i : PIPECHUNK;
+    if(copyin(pr->pagetable, buf, addr + i, m) == -1)
+      break;
+    acquire(&pi->lock);
+    for(j = 0; j < m; j++){
+      while(pi->nwrite == pi->nread + PIPESIZE){  //DOC: pipewrite-full
+        if(pi->readopen == 0 || pr->killed){
+          release(&pi->lock);
+          return -1;
+        }
+        wakeup(&pi->nread);
+        sleep(&pi->nwrite, &pi->lock);
       }
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
+      pi->data[pi->nwrite++ % PIPESIZE] = buf[j];
     }
-    if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-      break;
-    pi->data[pi->nwrite++ % PIPESIZE] = ch;
+    wakeup(&pi->nread);
+    release(&pi->lock);
   }
-  wakeup(&pi->nread);
-  release(&pi->lock);
   return i;
 }
 
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, m, tot = 0;
   struct proc *pr = myproc();
-  char ch;
+  char buf[PIPECHUNK];
 
+  // with the other readers kept out, bytes can stay in the
+  // pipe until they have been copied out, so a failed
+  // copyout() loses none of them.
+  acquiresleep(&pi->rlock);
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
     if(pr->killed){
       release(&pi->lock);
+      releasesleep(&pi->rlock);
       return -1;
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
-      break;
+  while(tot < n && pi->nread != pi->nwrite){
+    m = n - tot < PIPECHUNK ? n - tot : PIPECHUNK;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    for(i = 0; i < m; i++)  //DOC: piperead-copy
+      buf[i] = pi->data[(pi->nread + i) % PIPESIZE];
+    release(&pi->lock);
+    if(copyout(pr->pagetable, addr + tot, buf, m) == -1){
+      releasesleep(&pi->rlock);
+      return tot > 0 ? tot : -1;
+    }
+    acquire(&pi->lock);
+    pi->nread += m;
+    tot += m;
+    wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
-  return i;
+  releasesleep(&pi->rlock);
+  return tot;
 }
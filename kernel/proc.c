@@ -3,46 +3,249 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "defs.h"
 #include "sysinfo.h"
+#include "fcntl.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+// every proc there is, linked by p->allnext. the table
+// grows a page of procs at a time, up to NPROC, when none is
+// free, and never shrinks, so procs are never re-allocated
+// as anything else, and the list can be walked without a
+// lock, with new procs appearing at its head.
+struct proc *allproc;
+
+struct {
+  struct spinlock lock;
+  struct proc *free;    // UNUSED procs, linked by p->nextfree
+  int n;                // procs made so far
+} ptable;
 
 struct proc *initproc;
 
+uint harts;   // a bit for each hart in scheduler()
+
+// live procs by pid, for kill() and join(); chains are
+// linked by p->pidnext.
+#define NPIDHASH 256
+struct proc *pidhash[NPIDHASH];
+
 int nextpid = 1;
-struct spinlock pid_lock;
+struct spinlock pid_lock;   // also guards pidhash
+
+// the RUNNABLE procs, in the order they became so, so that
+// schedpick() and anyrunnable() needn't look at the rest.
+// the MLFQ scheduler has a queue per level. a proc goes on
+// when it becomes RUNNABLE, and comes off when a hart takes
+// it to run; one that can't run on the hart looking stays.
+// runq.lock comes after any p->lock.
+#ifdef SCHED_MLFQ
+#define NRUNQ NMLFQ
+#else
+#define NRUNQ 1
+#endif
+struct {
+  struct spinlock lock;
+  struct proc *head[NRUNQ];   // linked by p->runnext
+  struct proc *tail[NRUNQ];
+} runq;
+
+// procs in sleep(), hashed by channel, so that wakeup() needn't
+// look at the rest. a queue's lock comes after any p->lock.
+#define NSLEEPQ 64
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;          // linked by p->sleepnext
+} sleepqs[NSLEEPQ];
+
+// helps ensure that wakeups of wait()ing parents are not
+// lost, and guards the parent and child lists. it comes
+// before any p->lock.
+struct spinlock wait_lock;
+
+// Address space IDs tag TLB entries with the page table they
+// came from, so that switching page tables needn't flush the
+// TLB. Each process gets a pair: p->asid for its user page
+// table, p->asid+1 for its kernel page table. They are handed
+// out in generations: when a generation runs out, the next one
+// starts, every process gets a fresh pair the next time it
+// runs, and every hart flushes its whole TLB once before using
+// one of them.
+struct {
+  struct spinlock lock;
+  uint64 max;      // largest ASID the hardware has; 0 if none
+  uint64 gen;      // current generation
+  uint64 next;     // next unused ASID in this generation
+} asids;
 
 extern void forkret(void);
+static void kthreadstart(void);
+static void schedtail(void);
 static void wakeup1(struct proc *chan);
+static void runqput(struct proc *p);
+static void runqdel(struct proc *p);
+static void kickidle(struct proc *p);
 static void freeproc(struct proc *p);
+static void threadfree(struct proc *g, struct proc *t);
 
 extern char trampoline[]; // trampoline.S
+extern pagetable_t kernel_pagetable; // vm.c
 
 // initialize the proc table at boot time.
 void
 procinit(void)
 {
-  struct proc *p;
-  
   initlock(&pid_lock, "nextpid");
-  for(p = proc; p < &proc[NPROC]; p++) {
-      initlock(&p->lock, "proc");
-
-      // Allocate a page for the process's kernel stack.
-      // Map it high in memory, followed by an invalid
-      // guard page.
-      char *pa = kalloc();
-      if(pa == 0)
-        panic("kalloc");
-      uint64 va = KSTACK((int) (p - proc));
-      kvmmap(va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
-      p->kstack = va;
-  }
+  initlock(&wait_lock, "wait_lock");
+  initlock(&ptable.lock, "ptable");
+  initlock(&runq.lock, "runq");
+  for(int i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepqs[i].lock, "sleepq");
+  if(sizeof(struct proc) > PGSIZE)
+    panic("procinit");
   kvminithart();
+  asidinit();
+}
+
+// Find out how many ASID bits the hardware implements, by
+// writing ones to satp's ASID field and reading them back.
+// ASID 0 is the kernel's.
+void
+asidinit(void)
+{
+  uint64 satp = r_satp();
+
+  initlock(&asids.lock, "asids");
+  w_satp(satp | SATP_ASID(0xFFFF));
+  asids.max = SATP2ASID(r_satp());
+  w_satp(satp);
+  sfence_vma();
+#ifdef NOASID
+  asids.max = 0;
+#endif
+  if(asids.max < 2)
+    asids.max = 0;   // not enough for a pair.
+  asids.gen = 1;
+  asids.next = 1;
+}
+
+int
+hasasids(void)
+{
+  return asids.max != 0;
+}
+
+// Return the ASID that p's page table should run with on
+// this hart, allocating one if p has none from the current
+// generation, and flushing whatever this hart's TLB may still
+// hold for it. Returns 0 if the hardware has no ASIDs, in
+// which case the caller must flush the TLB after switching
+// to p's page table. Interrupts must be off.
+uint64
+asidget(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  uint64 bit = 1L << cpuid();
+
+  if(asids.max == 0)
+    return 0;
+
+  // a hart that has seen the current generation can't hold
+  // stale entries for any ASID in it, so there's no need
+  // for the lock if nothing is changing.
+  if(p->asidgen != asids.gen || c->asidgen != asids.gen){
+    acquire(&asids.lock);
+    if(p->asidgen != asids.gen){
+      if(asids.next + 1 > asids.max){
+        asids.gen++;
+        asids.next = 1;
+      }
+      p->asid = asids.next;
+      asids.next += 2;
+      p->asidgen = asids.gen;
+      __sync_fetch_and_and(&p->tlbstale, 0);
+    }
+    if(c->asidgen != asids.gen){
+      // entries from older generations may use any ASID.
+      sfence_vma();
+      c->asidgen = asids.gen;
+      __sync_fetch_and_and(&p->tlbstale, ~bit);
+    }
+    release(&asids.lock);
+  }
+
+  if(p->tlbstale & bit){
+    __sync_fetch_and_and(&p->tlbstale, ~bit);
+    sfence_vma_asid(p->asid);
+    sfence_vma_asid(p->asid + 1);
+  }
+  return p->asid;
+}
+
+// Return the satp for p's kernel page table.
+// Interrupts must be off.
+uint64
+proc_ksatp(struct proc *p)
+{
+  uint64 asid = asidget(p);
+
+  return MAKE_SATP(p->kpagetable) | SATP_ASID(asid ? asid + 1 : 0);
+}
+
+// The mappings for npages starting at va in p's page table
+// have changed. Drop them from p's kernel page table, flush
+// them from this hart's TLB, and have the other harts flush
+// p's ASIDs before they next run p.
+static void
+tlbinval(struct proc *p, uint64 va, uint64 npages)
+{
+  uint64 uasid, kasid;
+
+  kvmunmirror(p->kpagetable, va, npages);
+
+  // without ASIDs everything is ASID 0, and other harts
+  // flush whenever they switch page tables.
+  uasid = asids.max ? p->asid : 0;
+  kasid = asids.max ? p->asid + 1 : 0;
+  push_off();
+  if(npages > 64){
+    sfence_vma_asid(uasid);
+    sfence_vma_asid(kasid);
+  } else {
+    for(uint64 i = 0; i < npages; i++){
+      sfence_vma_page(va + i*PGSIZE, uasid);
+      sfence_vma_page(va + i*PGSIZE, kasid);
+    }
+  }
+  if(asids.max)
+    __sync_fetch_and_or(&p->tlbstale, ~(1L << cpuid()));
+  pop_off();
+}
+
+// Do tlbinval() for p and every other thread that shares its
+// page table. None of them may be running on another hart,
+// unless the mappings only gained permissions; see mmstop().
+// Caller must not hold the group's memlock.
+void
+proc_tlbinval(struct proc *p, uint64 va, uint64 npages)
+{
+  struct proc *g = p->group, *t;
+
+  if(g->nthread == 0){
+    tlbinval(p, va, npages);
+    // a vfork() child's parents use the page table too.
+    for(t = p->vfparent; t; t = t->vfparent)
+      tlbinval(t, va, npages);
+    return;
+  }
+  acquire(&g->memlock);
+  for(t = allproc; t; t = t->allnext)
+    if(t->group == g)
+      tlbinval(t, va, npages);
+  release(&g->memlock);
 }
 
 // Must be called with interrupts disabled,
@@ -74,6 +277,57 @@ myproc(void) {
   return p;
 }
 
+// Make a page of new procs, if NPROC allows, and free them.
+// Caller must hold ptable.lock.
+static void
+procgrow(void)
+{
+  struct proc *p;
+  char *page;
+  int i;
+
+  if(ptable.n >= NPROC || (page = kalloc()) == 0)
+    return;
+  memset(page, 0, PGSIZE);
+  for(i = 0; i < PGSIZE / sizeof(struct proc) && ptable.n < NPROC; i++){
+    p = (struct proc*)page + i;
+    initlock(&p->lock, "proc");
+    initlock(&p->memlock, "memlock");
+    initsleeplock(&p->mmlock, "mmlock");
+    p->kstack = KSTACK(ptable.n);
+    ptable.n++;
+    p->nextfree = ptable.free;
+    ptable.free = p;
+    // walkers of the list must see p initialized.
+    p->allnext = allproc;
+    __sync_synchronize();
+    allproc = p;
+  }
+}
+
+// Return the proc with the given pid, with p->lock held,
+// or 0 if there is none.
+static struct proc*
+pidproc(int pid)
+{
+  struct proc *p;
+
+  acquire(&pid_lock);
+  for(p = pidhash[(uint)pid % NPIDHASH]; p; p = p->pidnext)
+    if(p->pid == pid)
+      break;
+  release(&pid_lock);
+  if(p == 0)
+    return 0;
+  // p may have been freed meanwhile.
+  acquire(&p->lock);
+  if(p->pid != pid){
+    release(&p->lock);
+    return 0;
+  }
+  return p;
+}
+
 int
 allocpid() {
   int pid;
@@ -86,43 +340,77 @@ allocpid() {
   return pid;
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
-// and return with p->lock held.
+// Take an UNUSED proc from the process table, growing it if
+// need be, and map a kernel stack for it.
+// Initialize state required
+// to run in the kernel, and, if user is set, a trapframe and
+// empty page tables for user memory, and return with p->lock held.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc*
-allocproc(void)
+allocproc(int user)
 {
   struct proc *p;
+  char *stack = 0;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
-    }
+  acquire(&ptable.lock);
+  if(ptable.free == 0)
+    procgrow();
+  if((p = ptable.free) == 0){
+    release(&ptable.lock);
+    return 0;
+  }
+  // a fresh kernel stack. every kernel page table shares the
+  // mapping, and a hart may still have the translation to the
+  // stack of an earlier proc in the slot cached, under any
+  // ASID, so each flushes it before it first runs p.
+  if((stack = kalloc()) == 0 ||
+     mappages(kernel_pagetable, p->kstack, PGSIZE, (uint64)stack,
+              PTE_R | PTE_W) != 0){
+    if(stack)
+      kfree(stack);
+    release(&ptable.lock);
+    return 0;
   }
+  p->kstackstale = ~0L;
+  ptable.free = p->nextfree;
+  release(&ptable.lock);
 
+  acquire(&p->lock);
+  p->pid = allocpid();
+  acquire(&pid_lock);
+  p->pidnext = pidhash[p->pid % NPIDHASH];
+  pidhash[p->pid % NPIDHASH] = p;
+  release(&pid_lock);
+  p->state = USED;
+  p->group = p;
   p->mask = 0;
+  p->tickets = NTICKETS;
+  p->affinity = (1 << NCPU) - 1;
 
-  return 0;
+  if(user){
+    p->tslots = 1;   // the first thread's trapframe is at TRAPFRAME.
 
-found:
-  p->pid = allocpid();
+    // Allocate a trapframe page.
+    if((p->trapframe = (struct trapframe *)kalloc()) == 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
 
-  // Allocate a trapframe page.
-  if((p->trapframe = (struct trapframe *)kalloc()) == 0){
-    release(&p->lock);
-    return 0;
-  }
+    // An empty user page table.
+    p->pagetable = proc_pagetable(p);
+    if(p->pagetable == 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
-    freeproc(p);
-    release(&p->lock);
-    return 0;
+    // A kernel page table, to mirror the user's.
+    if((p->kpagetable = kvmcreate()) == 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
   }
 
   // Set up new context to start executing at forkret,
@@ -134,26 +422,78 @@ found:
   return p;
 }
 
+// Take p out of pidhash.
+static void
+pidunhash(struct proc *p)
+{
+  struct proc **pp;
+
+  acquire(&pid_lock);
+  for(pp = &pidhash[p->pid % NPIDHASH]; *pp; pp = &(*pp)->pidnext){
+    if(*pp == p){
+      *pp = p->pidnext;
+      break;
+    }
+  }
+  release(&pid_lock);
+  p->pidnext = 0;
+}
+
 // free a proc structure and the data hanging from it,
 // including user pages.
 // p->lock must be held.
 static void
 freeproc(struct proc *p)
 {
+  pte_t *pte;
+
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
+  if(p->kpagetable)
+    kvmfree(p->kpagetable);
+  p->kpagetable = 0;
   p->sz = 0;
+  if(p->pid)
+    pidunhash(p);
   p->pid = 0;
   p->parent = 0;
+  p->children = 0;
+  p->sibling = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->asidgen = 0;
+  p->kfn = 0;
+  p->karg = 0;
+  p->group = 0;
+  p->tslot = 0;
+  p->tslots = 0;
+  p->nthread = 0;
+  p->mmstopper = 0;
+  p->vfparent = 0;
+  p->vfchild = 0;
+  p->wakee = 0;
+  p->level = 0;
+  p->pass = 0;
+  p->ticks = 0;
   p->state = UNUSED;
+
+  // the proc stays in the table, but its kernel stack goes.
+  // p isn't running on it, and no hart uses the address again
+  // until it has flushed it; see kstackfresh().
+  acquire(&ptable.lock);
+  if((pte = walk(kernel_pagetable, p->kstack, 0)) != 0 && (*pte & PTE_V)){
+    kfree((void*)PTE2PA(*pte));
+    *pte = 0;
+  }
+  p->nextfree = ptable.free;
+  ptable.free = p;
+  release(&ptable.lock);
 }
 
 // Create a user page table for a given process,
@@ -186,6 +526,15 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
+  // the time, for clock_gettime() to read.
+  if(mappages(pagetable, TIMEPAGE, PGSIZE,
+              (uint64)timepage, PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
   return pagetable;
 }
 
@@ -196,6 +545,7 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, TIMEPAGE, 1, 0);
   uvmfree(pagetable, sz);
 }
 
@@ -217,13 +567,14 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(1);
   initproc = p;
   
   // allocate one user page and copy init's instructions
   // and data into it.
   uvminit(p->pagetable, initcode, sizeof(initcode));
   p->sz = PGSIZE;
+  kvmmirror(p->kpagetable, p->pagetable, 0, p->sz);
 
   // prepare for the very first "return" from kernel to user.
   p->trapframe->epc = 0;      // user program counter
@@ -232,29 +583,334 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  makerunnable(p);
+
+  release(&p->lock);
+}
+
+// Start a kernel thread that runs fn(arg), which must not
+// return. It is a proc with no user memory or page tables,
+// so it runs on kernel_pagetable, and no parent to wait()
+// for it. Returns it, or 0 if there's no free proc.
+struct proc*
+kthread_create(void (*fn)(void*), void *arg, char *name)
+{
+  return kthread_create_on_cpu(fn, arg, name, -1);
+}
+
+// Like kthread_create(), but unless cpu is -1 the thread
+// only ever runs on hart cpu.
+struct proc*
+kthread_create_on_cpu(void (*fn)(void*), void *arg, char *name, int cpu)
+{
+  struct proc *p;
+
+  if((p = allocproc(0)) == 0)
+    return 0;
+  p->kfn = fn;
+  p->karg = arg;
+  p->context.ra = (uint64)kthreadstart;
+  safestrcpy(p->name, name, sizeof(p->name));
+  if(cpu >= 0)
+    p->affinity = 1 << cpu;
+  makerunnable(p);
+  release(&p->lock);
+  return p;
+}
+
+static void
+kthreadstart(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler, or handoff().
+  schedtail();
+  release(&p->lock);
+  p->kfn(p->karg);
+  panic("kthread returned");
+}
+
+// Create a thread of the current process: a proc that shares
+// its page table, memory and open files, with a trapframe of
+// its own at THREADTRAPFRAME(slot), which starts running at
+// fn with sp and a0 set to stack. The first thread, whose
+// proc is the group's, waits for it with join(), and exit()
+// in the first thread kills the rest.
+// Returns the new thread's pid, or -1.
+int
+clone(uint64 fn, uint64 stack, int flags)
+{
+  struct proc *np, *p = myproc(), *g = p->group;
+  int slot, pid;
+
+  if(flags != (CLONE_VM|CLONE_FILES) || stack % 16 != 0 || p->vfparent)
+    return -1;
+
+  // reserve a slot, and count the thread before it exists,
+  // so that exit() waits for it.
+  acquire(&g->lock);
+  for(slot = 1; slot < NTHREAD && (g->tslots & (1 << slot)); slot++)
+    ;
+  if(slot == NTHREAD || g->killed){
+    release(&g->lock);
+    return -1;
+  }
+  g->tslots |= 1 << slot;
+  g->nthread++;
+  release(&g->lock);
+
+  if((np = allocproc(0)) == 0)
+    goto bad;
+  if((np->trapframe = (struct trapframe *)kalloc()) == 0 ||
+     (np->kpagetable = kvmcreate()) == 0){
+    freeproc(np);
+    release(&np->lock);
+    goto bad;
+  }
+  acquire(&g->memlock);
+  if(mappages(g->pagetable, THREADTRAPFRAME(slot), PGSIZE,
+              (uint64)np->trapframe, PTE_R | PTE_W) != 0){
+    release(&g->memlock);
+    freeproc(np);
+    release(&np->lock);
+    goto bad;
+  }
+  np->group = g;
+  np->pagetable = g->pagetable;
+  release(&g->memlock);
+  np->tslot = slot;
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->sp = stack;
+  np->trapframe->a0 = stack;
+  np->parent = g;
+  np->mask = p->mask;
+  np->tickets = p->tickets;
+  np->affinity = p->affinity;
+  np->cwd = idup(p->cwd);
+  safestrcpy(np->name, p->name, sizeof(p->name));
+  pid = np->pid;
+  makerunnable(np);
+  release(&np->lock);
+  return pid;
+
+ bad:
+  acquire(&g->lock);
+  g->tslots &= ~(1 << slot);
+  g->nthread--;
+  wakeup1(g);
+  release(&g->lock);
+  return -1;
+}
+
+// Free the thread t, a zombie, and its slot in g.
+// Caller must hold g->lock and t->lock.
+static void
+threadfree(struct proc *g, struct proc *t)
+{
+  acquire(&g->memlock);
+  // no proc_tlbinval(): only t used the slot, and t's ASIDs
+  // aren't handed out again until a new generation flushes.
+  uvmunmap(g->pagetable, THREADTRAPFRAME(t->tslot), 1, 0);
+  t->group = 0;
+  release(&g->memlock);
+  g->tslots &= ~(1 << t->tslot);
+  g->nthread--;
+  t->pagetable = 0;
+  freeproc(t);
+}
+
+// Wait for the thread tid of the current process to exit.
+// Return 0, or -1 if there is no such thread.
+int
+join(int tid)
+{
+  struct proc *t, *p = myproc(), *g = p->group;
+
+  if(tid == g->pid || tid == p->pid)
+    return -1;
+
+  // hold g->lock for the whole time, as wait() does.
+  acquire(&g->lock);
+  for(;;){
+    if((t = pidproc(tid)) == 0){
+      release(&g->lock);
+      return -1;
+    }
+    if(t->group != g){
+      release(&t->lock);
+      release(&g->lock);
+      return -1;
+    }
+    if(t->state == ZOMBIE){
+      threadfree(g, t);
+      release(&t->lock);
+      release(&g->lock);
+      return 0;
+    }
+    release(&t->lock);
+    if(p->killed){
+      release(&g->lock);
+      return -1;
+    }
+    sleep(g, &g->lock);
+  }
+}
+
+// Kill the other threads of p, the first thread of its group,
+// and free them once they have exited.
+static void
+killthreads(struct proc *p)
+{
+  struct proc *t;
 
+  acquire(&p->lock);
+  p->killed = 1;   // no more clone()s.
+  while(p->nthread > 0){
+    for(t = allproc; t; t = t->allnext){
+      if(t == p || t->group != p)
+        continue;
+      acquire(&t->lock);
+      if(t->group == p){
+        if(t->state == ZOMBIE){
+          threadfree(p, t);
+        } else {
+          t->killed = 1;
+          if(t->state == SLEEPING)
+            makerunnable(t);
+        }
+      }
+      release(&t->lock);
+    }
+    if(p->nthread > 0)
+      sleep(p, &p->lock);
+  }
   release(&p->lock);
 }
 
+// Take the lock on changes to p's memory layout and, if p
+// has other threads, wait until none of them is running, and
+// keep them from running until mmstart(). Pages can then go
+// without another hart still having them in its TLB, since a
+// thread's stale TLB entries are flushed before it next runs
+// (see proc_tlbinval()).
+// The caller must not sleep for a lock that a stopped thread
+// might hold.
+void
+mmstop(struct proc *p)
+{
+  struct proc *g = p->group, *t;
+  int running;
+
+  acquiresleep(&g->mmlock);
+  g->mmstopper = p;
+  __sync_synchronize();
+  if(g->nthread == 0)
+    return;
+  for(t = allproc; t; t = t->allnext){
+    if(t == p || t->group != g)
+      continue;
+    for(;;){
+      acquire(&t->lock);
+      running = t->group == g && t->state == RUNNING;
+      release(&t->lock);
+      if(!running)
+        break;
+      // the timer will make it yield.
+      acquire(&tickslock);
+      sleep(&ticks, &tickslock);
+      release(&tickslock);
+    }
+  }
+}
+
+void
+mmstart(struct proc *p)
+{
+  struct proc *g = p->group;
+
+  g->mmstopper = 0;
+  releasesleep(&g->mmlock);
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
 {
   uint sz;
-  struct proc *p = myproc();
+  struct proc *p = myproc(), *g = p->group;
 
-  sz = p->sz;
+  // a vfork() child's memory isn't its own.
+  if(p->vfparent)
+    return -1;
+
+  // other threads mustn't keep using pages that go.
+  if(n < 0)
+    mmstop(p);
+  else
+    acquiresleep(&g->mmlock);
+  sz = g->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
-      return -1;
+    if((uint64)sz + n > vmabase(p))
+      goto bad;
+    // if memory runs short, swap pages out to make room.
+    for(;;){
+      acquire(&g->memlock);
+      sz = uvmalloc(p->pagetable, g->sz, g->sz + n);
+      release(&g->memlock);
+      if(sz != 0)
+        break;
+      if(swapreclaim(PGROUNDUP(n) / PGSIZE) == 0)
+        goto bad;
     }
   } else if(n < 0){
+    // memlock keeps interrupts off, since swap.c could
+    // otherwise take a page out from under uvmunmap().
+    acquire(&g->memlock);
     sz = uvmdealloc(p->pagetable, sz, sz + n);
+    release(&g->memlock);
+  }
+  // a hart may have cached the new pages as invalid,
+  // or the old ones as valid.
+  if(sz != g->sz){
+    uint64 lo = PGROUNDDOWN(sz < g->sz ? sz : g->sz);
+    uint64 hi = PGROUNDUP(sz < g->sz ? g->sz : sz);
+    proc_tlbinval(p, lo, (hi - lo) / PGSIZE);
   }
-  p->sz = sz;
+  if(sz > g->sz)
+    kvmmirror(p->kpagetable, p->pagetable, g->sz, sz);
+  g->sz = sz;
+  if(n < 0)
+    mmstart(p);
+  else
+    releasesleep(&g->mmlock);
   return 0;
+
+ bad:
+  releasesleep(&g->mmlock);
+  return -1;
+}
+
+// Make np a child of p.
+static void
+addchild(struct proc *p, struct proc *np)
+{
+  acquire(&wait_lock);
+  np->parent = p;
+  np->sibling = p->children;
+  p->children = np;
+  release(&wait_lock);
+}
+
+// Mark p as copying its memory for fork(), or done.
+static void
+forking(struct proc *p, int on)
+{
+  acquire(&p->lock);
+  p->forking = on;
+  release(&p->lock);
 }
 
 // Create a new process, copying the parent.
@@ -264,24 +920,56 @@ fork(void)
 {
   int i, pid;
   struct proc *np;
-  struct proc *p = myproc();
+  struct proc *p = myproc(), *g = p->group;
+
+  // the child shares MAP_SHARED pages, so they must exist.
+  if(vmapopulate(p) < 0)
+    return -1;
+
+ retry:
+  // keep other threads from changing the layout meanwhile.
+  acquiresleep(&g->mmlock);
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(1)) == 0){
+    releasesleep(&g->mmlock);
     return -1;
   }
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  // Copy user memory from parent to child. If memory runs
+  // short, swap pages out (the parent's too, whose swapped
+  // pages cost the child nothing) and try again.
+  // The copy may yield, dropping np->lock, which is safe
+  // while np is USED (see preempt()); swap.c and ksm.c
+  // leave p's pages alone meanwhile.
+  forking(p, 1);
+  p->droplock = &np->lock;
+  if(uvmcopy(p->pagetable, np->pagetable, g->sz) < 0){
+    p->droplock = 0;
     freeproc(np);
     release(&np->lock);
+    releasesleep(&g->mmlock);
+    forking(p, 0);
+    if(swapreclaim(PGROUNDUP(g->sz) / PGSIZE) > 0)
+      goto retry;
     return -1;
   }
-  np->sz = p->sz;
+  np->sz = g->sz;
+  if(vmacopy(p, np) < 0){
+    p->droplock = 0;
+    freeproc(np);
+    release(&np->lock);
+    releasesleep(&g->mmlock);
+    forking(p, 0);
+    return -1;
+  }
+  p->droplock = 0;
+  releasesleep(&g->mmlock);
+  kvmmirror(np->kpagetable, np->pagetable, 0, np->sz);
   
   np->mask = p->mask; // Add
-
-  np->parent = p;
+  np->tickets = p->tickets;
+  np->affinity = p->affinity;
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -289,109 +977,269 @@ fork(void)
   // Cause fork to return 0 in the child.
   np->trapframe->a0 = 0;
 
-  // increment reference counts on open file descriptors.
+  // increment reference counts on open file descriptors,
+  // under g->lock, since threads share them.
+  acquire(&g->lock);
   for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
+    if(g->ofile[i])
+      np->ofile[i] = filedup(g->ofile[i]);
+  release(&g->lock);
   np->cwd = idup(p->cwd);
+  if(g->execip)
+    np->execip = idup(g->execip);
+  memmove(np->seg, g->seg, sizeof(g->seg));
+  np->nseg = g->nseg;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
   pid = np->pid;
 
-  np->state = RUNNABLE;
+  release(&np->lock);
+  forking(p, 0);
+
+  addchild(p, np);
 
+  acquire(&np->lock);
+  makerunnable(np);
   release(&np->lock);
 
   return pid;
 }
 
-// Pass p's abandoned children to init.
-// Caller must hold p->lock.
-void
-reparent(struct proc *p)
+// Point TRAPFRAME in pagetable at tf.
+static void
+maptrapframe(pagetable_t pagetable, struct trapframe *tf)
 {
-  struct proc *pp;
+  pte_t *pte;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    // this code uses pp->parent without holding pp->lock.
-    // acquiring the lock first could cause a deadlock
-    // if pp or a child of pp were also in exit()
-    // and about to try to lock p.
-    if(pp->parent == p){
-      // pp->parent can't change between the check and the acquire()
-      // because only the parent changes it, and we're the parent.
-      acquire(&pp->lock);
-      pp->parent = initproc;
-      // we should wake up init here, but that would require
-      // initproc->lock, which would be a deadlock, since we hold
-      // the lock on one of init's children (pp). this is why
-      // exit() always wakes init (before acquiring any locks).
-      release(&pp->lock);
-    }
-  }
+  if((pte = walk(pagetable, TRAPFRAME, 0)) == 0)
+    panic("maptrapframe");
+  *pte = PA2PTE(tf) | PTE_R | PTE_W | PTE_V;
 }
 
-// Exit the current process.  Does not return.
-// An exited process remains in the zombie state
-// until its parent calls wait().
-void
-exit(int status)
+// Create a child that runs in the current process's memory,
+// without copying it, and suspend the current process until
+// the child calls exec() or exit(), when vfdone() gives it
+// back. Meanwhile the child has its own trapframe at TRAPFRAME
+// in the page table, and must not change the memory's layout.
+// The parent's mmap() regions aren't the child's: it can use
+// their pages that are already in, but a fault in one kills it.
+// A process with threads gets fork() instead.
+int
+vfork(void)
 {
+  int i, pid;
+  struct proc *np;
   struct proc *p = myproc();
 
-  if(p == initproc)
-    panic("init exiting");
+  if(p->group != p || p->nthread > 0)
+    return fork();
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
-  }
+  if((np = allocproc(1)) == 0)
+    return -1;
+  proc_freepagetable(np->pagetable, 0);
+  np->pagetable = p->pagetable;
+  np->sz = p->sz;
+  np->vfparent = p;
 
-  begin_op();
-  iput(p->cwd);
-  end_op();
-  p->cwd = 0;
+  np->mask = p->mask;
+  np->tickets = p->tickets;
+  np->affinity = p->affinity;
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->a0 = 0;
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  np->cwd = idup(p->cwd);
+  if(p->execip)
+    np->execip = idup(p->execip);
+  memmove(np->seg, p->seg, sizeof(p->seg));
+  np->nseg = p->nseg;
+  safestrcpy(np->name, p->name, sizeof(p->name));
+  pid = np->pid;
+  release(&np->lock);
+
+  addchild(p, np);
+  acquire(&p->lock);
+  p->vfchild = np;
+  release(&p->lock);
+  maptrapframe(p->pagetable, np->trapframe);
+  acquire(&np->lock);
+  makerunnable(np);
+  release(&np->lock);
+
+  // not even kill() ends the wait, since the child is
+  // using the memory.
+  acquire(&p->lock);
+  while(p->vfchild)
+    sleep(&p->vfchild, &p->lock);
+  release(&p->lock);
+  return pid;
+}
+
+// p, a vfork() child, is done with its parent's memory, and
+// is no longer using the page table: give it back.
+void
+vfdone(struct proc *p)
+{
+  struct proc *pp = p->vfparent;
+
+  maptrapframe(pp->pagetable, pp->trapframe);
+  p->vfparent = 0;
+  acquire(&pp->lock);
+  pp->vfchild = 0;
+  release(&pp->lock);
+  wakeup(&pp->vfchild);
+}
+
+// Create a process running the program at path with argv,
+// without copying the current process's memory, as fork()
+// and exec() would. For i < nfd, its file descriptor i is a
+// copy of the current process's fdmap[i], or closed if that's
+// -1; the rest are closed. If fdmap is 0, it gets copies of
+// all of them, as from fork().
+// Returns its pid, or -1.
+int
+spawn(char *path, char **argv, int *fdmap, int nfd)
+{
+  struct proc *np, *p = myproc(), *g = p->group;
+  int i, fd, argc, pid;
+
+  for(i = 0; fdmap && i < nfd; i++){
+    fd = fdmap[i];
+    if(fd < -1 || fd >= NOFILE || (fd >= 0 && g->ofile[fd] == 0))
+      return -1;
+  }
+
+  if((np = allocproc(1)) == 0)
+    return -1;
+  // loading sleeps; USED keeps np from running meanwhile.
+  release(&np->lock);
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  if((argc = execload(np, path, argv)) < 0){
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->trapframe->a0 = argc;
+
+  acquire(&g->lock);
+  for(i = 0; i < NOFILE; i++){
+    fd = fdmap == 0 ? i : (i < nfd ? fdmap[i] : -1);
+    if(fd >= 0 && g->ofile[fd])
+      np->ofile[i] = filedup(g->ofile[fd]);
+  }
+  release(&g->lock);
+  np->cwd = idup(p->cwd);
+  np->mask = p->mask;
+  np->tickets = p->tickets;
+  np->affinity = p->affinity;
+
+  addchild(p, np);
+  acquire(&np->lock);
+  pid = np->pid;
+  makerunnable(np);
+  release(&np->lock);
+  return pid;
+}
 
-  // we might re-parent a child to init. we can't be precise about
-  // waking up init, since we can't acquire its lock once we've
-  // acquired any other proc lock. so wake up init whether that's
-  // necessary or not. init may miss this wakeup, but that seems
-  // harmless.
+// Pass p's abandoned children to init.
+// Caller must hold wait_lock.
+void
+reparent(struct proc *p)
+{
+  struct proc *pp;
+
+  if(p->children == 0)
+    return;
+  for(pp = p->children; ; pp = pp->sibling){
+    pp->parent = initproc;
+    if(pp->sibling == 0)
+      break;
+  }
+  pp->sibling = initproc->children;
+  initproc->children = p->children;
+  p->children = 0;
+  // some may be zombies already.
   acquire(&initproc->lock);
   wakeup1(initproc);
   release(&initproc->lock);
+}
 
-  // grab a copy of p->parent, to ensure that we unlock the same
-  // parent we locked. in case our parent gives us away to init while
-  // we're waiting for the parent lock. we may then race with an
-  // exiting parent, but the result will be a harmless spurious wakeup
-  // to a dead or wrong process; proc structs are never re-allocated
-  // as anything else.
-  acquire(&p->lock);
-  struct proc *original_parent = p->parent;
-  release(&p->lock);
-  
-  // we need the parent's lock in order to wake it up from wait().
-  // the parent-then-child rule says we have to lock it first.
-  acquire(&original_parent->lock);
+// Exit the current process.  Does not return.
+// An exited process remains in the zombie state
+// until its parent calls wait().
+void
+exit(int status)
+{
+  struct proc *p = myproc();
 
-  acquire(&p->lock);
+  if(p == initproc)
+    panic("init exiting");
+
+  // the memory and files belong to the first thread, which
+  // outlives the others.
+  if(p->group == p){
+    killthreads(p);
+
+    // Unmap mmap() regions, writing back MAP_SHARED ones.
+    vmaclear(p);
+
+    // Close all open files.
+    for(int fd = 0; fd < NOFILE; fd++){
+      if(p->ofile[fd]){
+        struct file *f = p->ofile[fd];
+        fileclose(f);
+        p->ofile[fd] = 0;
+      }
+    }
+  }
+
+  // a vfork() child's memory is its parent's.
+  if(p->vfparent){
+    acquire(&p->lock);
+    p->pagetable = 0;
+    p->sz = 0;
+    release(&p->lock);
+    vfdone(p);
+  }
+
+  begin_op();
+  iput(p->cwd);
+  if(p->execip)
+    iput(p->execip);
+  end_op();
+  p->cwd = 0;
+  p->execip = 0;
+
+  acquire(&wait_lock);
 
   // Give any children to init.
   reparent(p);
 
-  // Parent might be sleeping in wait().
-  wakeup1(original_parent);
-
-  p->xstate = status;
-  p->state = ZOMBIE;
+  if(p->group != p){
+    // a thread: the first thread may be in killthreads(),
+    // or other threads in join(), for this one, all
+    // sleeping on the group under its lock.
+    struct proc *g = p->group;
+    acquire(&g->lock);
+    wakeup(g);
+    acquire(&p->lock);
+    p->xstate = status;
+    p->state = ZOMBIE;
+    release(&g->lock);
+  } else {
+    // Parent might be sleeping in wait().
+    acquire(&p->parent->lock);
+    wakeup1(p->parent);
+    release(&p->parent->lock);
+    acquire(&p->lock);
+    p->xstate = status;
+    p->state = ZOMBIE;
+  }
 
-  release(&original_parent->lock);
+  release(&wait_lock);
 
   // Jump into the scheduler, never to return.
   sched();
@@ -403,52 +1251,318 @@ exit(int status)
 int
 wait(uint64 addr)
 {
-  struct proc *np;
-  int havekids, pid;
+  struct proc *np, **pp;
+  int pid, xstate;
   struct proc *p = myproc();
 
-  // hold p->lock for the whole time to avoid lost
+  // hold wait_lock for the whole time to avoid lost
   // wakeups from a child's exit().
-  acquire(&p->lock);
+  acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for(np = proc; np < &proc[NPROC]; np++){
-      // this code uses np->parent without holding np->lock.
-      // acquiring the lock first would cause a deadlock,
-      // since np might be an ancestor, and we already hold p->lock.
-      if(np->parent == p){
-        // np->parent can't change between the check and the acquire()
-        // because only the parent changes it, and we're the parent.
-        acquire(&np->lock);
-        havekids = 1;
-        if(np->state == ZOMBIE){
-          // Found one.
-          pid = np->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                  sizeof(np->xstate)) < 0) {
-            release(&np->lock);
-            release(&p->lock);
-            return -1;
-          }
-          freeproc(np);
+  rescan:
+    // Scan through the children looking for exited ones.
+    for(pp = &p->children; (np = *pp) != 0; pp = &np->sibling){
+      acquire(&np->lock);
+      if(np->state == ZOMBIE){
+        // Found one.
+        pid = np->pid;
+        xstate = np->xstate;
+        if(addr != 0){
+          // copy out before reaping, so that a bad addr doesn't
+          // lose the status, and without locks, since the page
+          // may have to be read in (see vmfault()).
           release(&np->lock);
-          release(&p->lock);
-          return pid;
+          release(&wait_lock);
+          if(copyout(p->pagetable, addr, (char *)&xstate, sizeof(xstate)) < 0)
+            return -1;
+          acquire(&wait_lock);
+          for(pp = &p->children; *pp != 0 && *pp != np; pp = &(*pp)->sibling)
+            ;
+          // another of our threads may have reaped it meanwhile.
+          if(*pp == 0 || np->pid != pid)
+            goto rescan;
+          acquire(&np->lock);
         }
+        *pp = np->sibling;
+        release(&wait_lock);
+        // off the list, np needs only its own lock, which
+        // freeing a big address space may drop to yield
+        // (see preempt()).
+        p->droplock = &np->lock;
+        freeproc(np);
+        p->droplock = 0;
         release(&np->lock);
+        return pid;
       }
+      release(&np->lock);
     }
 
     // No point waiting if we don't have any children.
-    if(!havekids || p->killed){
-      release(&p->lock);
+    if(p->children == 0 || p->killed){
+      release(&wait_lock);
       return -1;
     }
     
     // Wait for a child to exit.
-    sleep(p, &p->lock);  //DOC: wait-sleep
+    sleep(p, &wait_lock);  //DOC: wait-sleep
+  }
+}
+
+// Could p run now on the hart whose bit is hart? Reads p's
+// fields without p->lock, so the answer must be checked again
+// under the lock.
+static int
+canrun(struct proc *p, uint hart)
+{
+  struct proc *g = p->group;
+
+  // while a thread has stopped the others (see mmstop()),
+  // they don't run.
+  return p->state == RUNNABLE && (p->affinity & hart) && g &&
+    (g->mmstopper == 0 || g->mmstopper == p);
+}
+
+// A process's pass goes up by STRIDE1 / p->tickets for each
+// tick it runs. stridepass is the pass of the process picked
+// last, about the least of any that can run.
+#define STRIDE1 (1 << 20)
+#ifdef SCHED_STRIDE
+uint64 stridepass;
+#endif
+
+#ifdef SCHED_MLFQ
+// Every MLFQBOOST ticks, move every process back to queue
+// 0, so that those that lost their priority to a CPU-bound
+// phase get it back, and none starve.
+static void
+mlfqboost(void)
+{
+  static uint boosted;
+  uint t = boosted;
+  struct proc *p;
+
+  if(ticks - t < MLFQBOOST || !__sync_bool_compare_and_swap(&boosted, t, ticks))
+    return;
+  for(p = allproc; p; p = p->allnext)
+    p->level = 0;
+
+  // and the queued ones onto the end of queue 0.
+  acquire(&runq.lock);
+  for(int q = 1; q < NRUNQ; q++){
+    if(runq.head[q] == 0)
+      continue;
+    for(p = runq.head[q]; p; p = p->runnext)
+      p->onrunq = 1;
+    if(runq.tail[0])
+      runq.tail[0]->runnext = runq.head[q];
+    else
+      runq.head[0] = runq.head[q];
+    runq.head[q]->runprev = runq.tail[0];
+    runq.tail[0] = runq.tail[q];
+    runq.head[q] = runq.tail[q] = 0;
+  }
+  release(&runq.lock);
+}
+#endif
+
+// Put p, which is RUNNABLE, on the end of its run queue,
+// unless it is on one. Caller must hold p->lock.
+static void
+runqput(struct proc *p)
+{
+  int q = 0;
+
+#ifdef SCHED_MLFQ
+  q = p->level;
+#endif
+  acquire(&runq.lock);
+  if(p->onrunq == 0){
+    p->onrunq = q + 1;
+    p->runnext = 0;
+    p->runprev = runq.tail[q];
+    if(runq.tail[q])
+      runq.tail[q]->runnext = p;
+    else
+      runq.head[q] = p;
+    runq.tail[q] = p;
+  }
+  release(&runq.lock);
+}
+
+// Take p off its run queue. Caller must hold runq.lock.
+static void
+runqunlink(struct proc *p)
+{
+  int q = p->onrunq - 1;
+
+  if(p->runprev)
+    p->runprev->runnext = p->runnext;
+  else
+    runq.head[q] = p->runnext;
+  if(p->runnext)
+    p->runnext->runprev = p->runprev;
+  else
+    runq.tail[q] = p->runprev;
+  p->runnext = p->runprev = 0;
+  p->onrunq = 0;
+}
+
+// Take p off its run queue, if it is on one, to run it.
+// Caller must hold p->lock.
+static void
+runqdel(struct proc *p)
+{
+  acquire(&runq.lock);
+  if(p->onrunq)
+    runqunlink(p);
+  release(&runq.lock);
+}
+
+// p, whose lock the caller holds, may run again: make it
+// RUNNABLE, put it on the run queue, and kick an idle hart
+// that may run it.
+void
+makerunnable(struct proc *p)
+{
+  p->state = RUNNABLE;
+  runqput(p);
+  kickidle(p);
+}
+
+// Choose a process for this hart to run, and return it with
+// p->lock held, or return 0 if none can run. Only processes
+// whose affinity includes the hart are candidates, and only
+// those on the run queues are looked at.
+// Round robin takes the one that has waited longest. The
+// multi-level feedback queue (make SCHED=MLFQ) takes the
+// first one from the lowest queue that has any: a process
+// goes down a queue each time it uses up a time slice (see
+// timeryield()), and keeps its queue when it sleeps, so
+// interactive processes, which sleep before their slice is
+// up, run ahead of CPU-bound ones.
+// The stride scheduler (make SCHED=STRIDE) takes the one with
+// the least pass, so that over time each process runs in
+// proportion to its tickets (see settickets()).
+static struct proc*
+schedpick(struct cpu *c)
+{
+  struct proc *p, *best;
+  uint hart = 1 << (c - cpus);
+  int q;
+
+#ifdef SCHED_MLFQ
+  mlfqboost();
+#endif
+  for(;;){
+    best = 0;
+    acquire(&runq.lock);
+    for(q = 0; q < NRUNQ && best == 0; q++){
+      for(p = runq.head[q]; p; p = p->runnext){
+        if(!canrun(p, hart))
+          continue;
+#ifdef SCHED_STRIDE
+        if(best == 0 || p->pass < best->pass)
+          best = p;
+#else
+        best = p;
+        break;
+#endif
+      }
+    }
+    if(best)
+      runqunlink(best);
+    release(&runq.lock);
+    if(best == 0)
+      return 0;
+
+    acquire(&best->lock);
+    if(canrun(best, hart)){
+      // if another hart ran it meanwhile, it may be back.
+      runqdel(best);
+#ifdef SCHED_STRIDE
+      // a process that slept, or is new, gets no credit
+      // for the time it didn't want the CPU.
+      if(best->pass < stridepass)
+        best->pass = stridepass;
+      stridepass = best->pass;
+#endif
+      return best;
+    }
+    // it changed meanwhile. if it can still run somewhere,
+    // it goes back for the harts it may run on; look again.
+    if(best->state == RUNNABLE){
+      runqput(best);
+      kickidle(best);
+    }
+    release(&best->lock);
+  }
+}
+
+// Is there anything hart c could run?
+static int
+anyrunnable(struct cpu *c)
+{
+  struct proc *p;
+  uint hart = 1 << (c - cpus);
+  int q, any = 0;
+
+  acquire(&runq.lock);
+  for(q = 0; q < NRUNQ && !any; q++)
+    for(p = runq.head[q]; p && !any; p = p->runnext)
+      any = canrun(p, hart);
+  release(&runq.lock);
+  return any;
+}
+
+// Nothing to run: sleep without ticks until an interrupt,
+// which may be a kick from kickidle() on another hart.
+static void
+idle(struct cpu *c)
+{
+  intr_off();
+  c->idle = 1;
+  // pairs with kickidle(): either it sees idle set, or
+  // anyrunnable() sees what it made RUNNABLE.
+  __sync_synchronize();
+  ticksoff();
+  if(!anyrunnable(c))
+    asm volatile("wfi");
+  c->idle = 0;
+  tickson();
+  intr_on();
+}
+
+// p has just become RUNNABLE. If a hart it may run on is
+// idle, interrupt it to run p now, rather than at its
+// next tick, which may never come (see ticksoff()).
+// The caller hart isn't idle, so it's never picked.
+static void
+kickidle(struct proc *p)
+{
+  struct cpu *c;
+
+  __sync_synchronize();
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(c->idle && (p->affinity & (1 << (c - cpus))) &&
+       __sync_bool_compare_and_swap(&c->idle, 1, 0)){
+      *(uint32*)KCLINT_MSIP(c - cpus) = 1;
+      return;
+    }
+  }
+}
+
+// Flush this hart's TLB of any translation of p's kernel
+// stack address older than p's stack, before switching to p.
+// Interrupts must be off.
+static void
+kstackfresh(struct proc *p)
+{
+  uint64 bit = 1L << cpuid();
+
+  if(p->kstackstale & bit){
+    __sync_fetch_and_and(&p->kstackstale, ~bit);
+    sfence_vma_va(p->kstack);
   }
 }
 
@@ -466,33 +1580,37 @@ scheduler(void)
   struct cpu *c = mycpu();
   
   c->proc = 0;
+  __sync_fetch_and_or(&harts, 1 << (c - cpus));
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
     
-    int found = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-
-        found = 1;
-      }
-      release(&p->lock);
-    }
-    if(found == 0) {
-      intr_on();
-      asm volatile("wfi");
+    if((p = schedpick(c)) == 0){
+      idle(c);
+      continue;
     }
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    c->proc = p;
+    c->needresched = 0;
+    kstackfresh(p);
+    if(p->kpagetable)
+      kvmswitch(proc_ksatp(p));
+    swtch(&c->context, &p->context);
+
+    // p may have handed off to another process (see
+    // handoff()), so it's c->proc that's back.
+    p = c->proc;
+    if(p->kpagetable)
+      kvmswitch(MAKE_SATP(kernel_pagetable));
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -521,6 +1639,105 @@ sched(void)
   intena = mycpu()->intena;
   swtch(&p->context, &mycpu()->context);
   mycpu()->intena = intena;
+  schedtail();
+}
+
+// Finish a switch to this process from handoff(): now on
+// its own stack, switch to its kernel page table, and
+// release the lock of the process that handed off.
+static void
+schedtail(void)
+{
+  struct cpu *c = mycpu();
+
+  if(c->prev){
+    if(c->proc->kpagetable)
+      kvmswitch(proc_ksatp(c->proc));
+    else if(c->prev->kpagetable)
+      kvmswitch(MAKE_SATP(kernel_pagetable));
+    release(&c->prev->lock);
+    c->prev = 0;
+  }
+}
+
+// p, holding only p->lock, is going to sleep right after
+// waking t. If t can run on this hart, switch to it
+// directly, as sched() and scheduler() would in the end,
+// but with one swtch() rather than two and without looking
+// through the process table. Returns 0, having done
+// nothing, if not.
+static int
+handoff(struct proc *p, struct proc *t)
+{
+  struct cpu *c = mycpu();
+  int intena;
+
+#ifdef NOHANDOFF
+  return 0;
+#endif
+  if(t == p || c->noff != 1 || !tryacquire(&t->lock))
+    return 0;
+  if(!canrun(t, 1 << (c - cpus))){
+    release(&t->lock);
+    return 0;
+  }
+
+  runqdel(t);
+  t->state = RUNNING;
+  c->proc = t;
+  c->prev = p;
+  c->needresched = 0;
+  kstackfresh(t);
+
+  // t's page table goes in on t's stack, in schedtail(), so
+  // that p's stack is never used under t's ASID.
+  intena = c->intena;
+  swtch(&p->context, &t->context);
+  mycpu()->intena = intena;
+  schedtail();
+  return 1;
+}
+
+// Has a tick come that the current process should yield for?
+// It may still be waiting in sip, if interrupts are off.
+static int
+needresched(void)
+{
+  int r;
+
+  push_off();
+  r = mycpu()->needresched || (r_sip() & 2);
+  pop_off();
+  return r;
+}
+
+// A preemption point, for long loops in the kernel. With
+// interrupts on, kerneltrap() yields for a tick anyway; but a
+// loop holding a spinlock has them off, and so keeps the hart
+// until it's done. If p->droplock is the only spinlock held,
+// and a tick has come, release it, yield, and retake it. The
+// process that set p->droplock must allow for whatever others
+// do with the lock meanwhile.
+void
+preempt(void)
+{
+  struct proc *p = myproc();
+  struct spinlock *lk = 0;
+
+  if(p == 0 || !needresched())
+    return;
+  if(!intr_get()){
+    lk = p->droplock;
+    if(lk == 0 || !holding(lk) || mycpu()->noff != 1)
+      return;
+    // with interrupts back on, a tick waiting in sip yields
+    // from kerneltrap().
+    release(lk);
+  }
+  if(needresched())
+    timeryield();
+  if(lk)
+    acquire(lk);
 }
 
 // Give up the CPU for one scheduling round.
@@ -530,6 +1747,32 @@ yield(void)
   struct proc *p = myproc();
   acquire(&p->lock);
   p->state = RUNNABLE;
+  runqput(p);
+  sched();
+  release(&p->lock);
+}
+
+// Give up the CPU because the timer says the current
+// process's time slice is up, which costs it its queue
+// under the MLFQ scheduler, or a stride under the stride
+// scheduler.
+void
+timeryield(void)
+{
+  struct proc *p = myproc();
+
+  acquire(&p->lock);
+  mycpu()->needresched = 0;
+  p->ticks++;
+#ifdef SCHED_MLFQ
+  if(p->level < NMLFQ - 1)
+    p->level++;
+#endif
+#ifdef SCHED_STRIDE
+  p->pass += STRIDE1 / p->tickets;
+#endif
+  p->state = RUNNABLE;
+  runqput(p);
   sched();
   release(&p->lock);
 }
@@ -541,7 +1784,9 @@ forkret(void)
 {
   static int first = 1;
 
-  // Still holding p->lock from scheduler.
+  // Still holding p->lock from scheduler, or from handoff(),
+  // with the lock of the process that handed off.
+  schedtail();
   release(&myproc()->lock);
 
   if (first) {
@@ -555,31 +1800,71 @@ forkret(void)
   usertrapret();
 }
 
+// The sleep queue for chan. Channels are addresses, mostly
+// aligned, so multiply to mix their bits into the top 6,
+// which index the NSLEEPQ (64) queues.
+static struct sleepq*
+sleepqof(void *chan)
+{
+  return &sleepqs[((uint64)chan * 0x9E3779B97F4A7C15L) >> 58];
+}
+
+// Take p off its sleep queue. Caller must hold p->lock and
+// the queue's lock.
+static void
+sleepunlink(struct proc *p)
+{
+  *p->sleepprev = p->sleepnext;
+  if(p->sleepnext)
+    p->sleepnext->sleepprev = p->sleepprev;
+  p->sleepq = 0;
+  p->sleepnext = 0;
+  p->sleepprev = 0;
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
-  struct proc *p = myproc();
+  struct proc *p = myproc(), *t;
+  struct sleepq *q = sleepqof(chan);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
-  // so it's okay to release lk.
-  if(lk != &p->lock){  //DOC: sleeplock0
+  if(lk != &p->lock)  //DOC: sleeplock0
     acquire(&p->lock);  //DOC: sleeplock1
-    release(lk);
-  }
 
-  // Go to sleep.
+  // Go to sleep, on chan's queue before lk goes, so that
+  // the wakeup() of whoever takes lk next finds p there.
+  // It then waits for p->lock, which p holds until it is
+  // off this hart, so no wakeup is missed.
   p->chan = chan;
   p->state = SLEEPING;
+  acquire(&q->lock);
+  p->sleepq = q;
+  p->sleepprev = &q->head;
+  p->sleepnext = q->head;
+  if(q->head)
+    q->head->sleepprev = &p->sleepnext;
+  q->head = p;
+  release(&q->lock);
+  if(lk != &p->lock)
+    release(lk);
 
-  sched();
-
-  // Tidy up.
+  // straight to the process just woken, if there is one,
+  // as on a pipe whose reader and writer take turns.
+  t = p->wakee;
+  p->wakee = 0;
+  if(t == 0 || !handoff(p, t))
+    sched();
+
+  // Tidy up. p is still queued if kill() or the like woke it.
+  if((q = p->sleepq) != 0){
+    acquire(&q->lock);
+    sleepunlink(p);
+    release(&q->lock);
+  }
   p->chan = 0;
 
   // Reacquire original lock.
@@ -589,20 +1874,64 @@ sleep(void *chan, struct spinlock *lk)
   }
 }
 
+// Wake up to n of the processes sleeping on chan, and return
+// how many it woke, setting *first to the first of them.
+// The caller may hold the locks of any of them.
+static int
+wakechan(void *chan, int n, struct proc **first)
+{
+  struct sleepq *q = sleepqof(chan);
+  struct proc *p, *next;
+  int held, woke = 0;
+
+ again:
+  acquire(&q->lock);
+  for(p = q->head; p && woke < n; p = next){
+    next = p->sleepnext;
+    if(p->chan != chan)
+      continue;
+    // sleep() takes p->lock before q->lock, so don't wait
+    // for p->lock here; whoever has it holds it only briefly.
+    held = holding(&p->lock);
+    if(!held && !tryacquire(&p->lock)){
+      release(&q->lock);
+      goto again;
+    }
+    sleepunlink(p);
+    if(p->state == SLEEPING){
+      makerunnable(p);
+      if(woke++ == 0)
+        *first = p;
+    }
+    if(!held)
+      release(&p->lock);
+  }
+  release(&q->lock);
+  return woke;
+}
+
 // Wake up all processes sleeping on chan.
-// Must be called without any p->lock.
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  struct proc *me = myproc(), *woke = 0;
+  int n;
+
+  n = wakechan(chan, NPROC, &woke);
+  // if the caller sleeps next, it can hand off to the one
+  // it woke; see sleep().
+  if(me)
+    me->wakee = n == 1 ? woke : 0;
+}
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == SLEEPING && p->chan == chan) {
-      p->state = RUNNABLE;
-    }
-    release(&p->lock);
-  }
+// Wake up to n processes sleeping on chan.
+// Returns how many it woke.
+int
+wakeupn(void *chan, int n)
+{
+  struct proc *first;
+
+  return wakechan(chan, n, &first);
 }
 
 // Wake up p if it is sleeping in wait(); used by exit().
@@ -612,9 +1941,78 @@ wakeup1(struct proc *p)
 {
   if(!holding(&p->lock))
     panic("wakeup1");
-  if(p->chan == p && p->state == SLEEPING) {
-    p->state = RUNNABLE;
+  if(p->chan == p && p->state == SLEEPING)
+    makerunnable(p);
+}
+
+// Set the current process's tickets, its share of the CPU
+// under the stride scheduler. Children inherit them.
+int
+settickets(int n)
+{
+  struct proc *p = myproc();
+
+  if(n < 1 || n > STRIDE1)
+    return -1;
+  acquire(&p->lock);
+  p->tickets = n;
+  release(&p->lock);
+  return 0;
+}
+
+// Return how many timer ticks the process pid has run for,
+// or -1 if there's no such process.
+int
+getticks(int pid)
+{
+  struct proc *p;
+  int n;
+
+  if((p = pidproc(pid)) == 0)
+    return -1;
+  n = p->ticks;
+  release(&p->lock);
+  return n;
+}
+
+// Let the process pid, or the current one if pid is 0, run
+// only on the harts whose bits are set in mask, which must
+// name at least one that is running. Kernel threads can't
+// be moved, since some must stay on their hart.
+int
+sched_setaffinity(int pid, uint mask)
+{
+  struct proc *p;
+
+  if((mask & harts) == 0)
+    return -1;
+  if((p = pidproc(pid ? pid : myproc()->pid)) == 0)
+    return -1;
+  if(p->kfn){
+    release(&p->lock);
+    return -1;
   }
+  p->affinity = mask;
+  release(&p->lock);
+  // move to an allowed hart now, if this one isn't.
+  if(p == myproc())
+    yield();
+  return 0;
+}
+
+// Return the affinity mask of the process pid, or of the
+// current one if pid is 0, or -1.
+int
+sched_getaffinity(int pid)
+{
+  struct proc *p;
+  int mask;
+
+  if((p = pidproc(pid ? pid : myproc()->pid)) == 0)
+    return -1;
+  mask = p->affinity;
+  release(&p->lock);
+  return mask;
 }
 
 // Kill the process with the given pid.
@@ -625,20 +2023,15 @@ kill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
-    release(&p->lock);
+  if((p = pidproc(pid)) == 0)
+    return -1;
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep().
+    makerunnable(p);
   }
-  return -1;
+  release(&p->lock);
+  return 0;
 }
 
 // Copy to either a user address, or kernel address,
@@ -679,6 +2072,7 @@ procdump(void)
 {
   static char *states[] = {
   [UNUSED]    "unused",
+  [USED]      "used  ",
   [SLEEPING]  "sleep ",
   [RUNNABLE]  "runble",
   [RUNNING]   "run   ",
@@ -688,7 +2082,7 @@ procdump(void)
   char *state;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
+  for(p = allproc; p; p = p->allnext){
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
@@ -696,6 +2090,8 @@ procdump(void)
     else
       state = "???";
     printf("%d %s %s", p->pid, state, p->name);
+    if(p->pagetable)
+      printf(" superpages=%d", uvmsupercount(p->pagetable));
     printf("\n");
   }
 }
@@ -704,8 +2100,8 @@ void countProc(void* ptr) {
   struct sysinfo* inf = (struct sysinfo*)ptr;
   acquire(&pid_lock);
   int count = 0;
-  for (int i = 0 ; i < NPROC; i++) {
-    if (proc[i].state != UNUSED) {
+  for (struct proc *p = allproc; p; p = p->allnext) {
+    if (p->state != UNUSED) {
       count++;
     }
   }
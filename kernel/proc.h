@@ -24,6 +24,16 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation this cpu's TLB is clean for.
+  struct proc *prev;          // handed the cpu to c->proc; see handoff().
+  int needresched;            // a tick came for c->proc to yield for; see preempt().
+  int idle;                   // Asleep in scheduler(); see kickidle().
+
+  // this hart's timer; see timerintr().
+  struct spinlock timerlock;  // guards these and the hart's mtimecmp.
+  int tickless;               // no ticks while idle; see ticksoff().
+  uint64 nexttick;            // CLINT_MTIME of the next tick.
+  struct proc *timers;        // in nanosleep(), soonest deadline first.
 };
 
 extern struct cpu cpus[NCPU];
@@ -78,31 +88,116 @@ struct trapframe {
   /* 264 */ uint64 t4;
   /* 272 */ uint64 t5;
   /* 280 */ uint64 t6;
+  /* 288 */ uint64 kernel_flush;  // uservec must flush the TLB: no ASIDs
 };
 
-enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
+enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
+
+// A loadable segment of the program a process is running.
+// exec() only records it; vmfault() reads it in a page at a
+// time, on first touch. Memory past filesz is zero-filled.
+// Pages of read-only segments are shared; see segpage().
+struct seg {
+  uint64 va;                   // page-aligned start
+  uint64 off;                  // file offset of va
+  uint64 filesz;               // bytes that come from the file
+  uint64 memsz;                // bytes in memory
+  int perm;                    // PTE_R, PTE_W, PTE_X, PTE_U
+};
+
+// A region of memory made by mmap(). vmafault() fills its
+// pages in on first touch, from f at off if f != 0, and
+// vmaunmap() writes MAP_SHARED pages that have been written
+// back to f when they go.
+struct vma {
+  uint64 addr;                 // page-aligned start, 0 if unused
+  uint64 len;                  // bytes, a multiple of PGSIZE
+  int prot;                    // PROT_READ, PROT_WRITE, PROT_EXEC
+  int flags;                   // MAP_SHARED or MAP_PRIVATE, MAP_ANONYMOUS
+  struct file *f;              // mapped file, 0 if anonymous
+  uint64 off;                  // file offset of addr
+};
 
 // Per-process state
 struct proc {
   struct spinlock lock;
+  struct proc *allnext;        // next on allproc; never changes
+  struct proc *nextfree;       // next free proc, under ptable.lock
+  struct proc *pidnext;        // next in pid hash chain, under pid_lock
+
+  // runq.lock must be held when using these:
+  int onrunq;                  // 1 + the run queue it is on, or 0; see runqput()
+  struct proc *runnext;        // next on it
+  struct proc *runprev;        // ... and the one before
+
+  // both p->lock and the sleep queue's lock must be held to
+  // change these; either suffices to read them:
+  struct sleepq *sleepq;       // the sleep queue it is on, or 0; see sleep()
+  struct proc *sleepnext;      // next on it
+  struct proc **sleepprev;     // what points to it there
+
+  // the timerlock of timercpu must be held when using these:
+  struct cpu *timercpu;        // whose timers it is on, in nanosleep()
+  struct proc *timernext;      // next on timercpu->timers
+  uint64 wakeat;               // CLINT_MTIME to wake at
+
+  // wait_lock must be held when using these:
+  struct proc *parent;         // Parent process
+  struct proc *children;       // first child; threads aren't on the list
+  struct proc *sibling;        // next child of parent
 
   // p->lock must be held when using these:
   enum procstate state;        // Process state
-  struct proc *parent;         // Parent process
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int nthread;                 // threads sharing this one's memory; see clone()
+  uint tslots;                 // ... bit per trapframe slot in use
+  struct proc *vfchild;        // vfork() child using this one's memory
+  int level;                   // MLFQ queue, 0 the first; see schedpick()
+  int tickets;                 // share of the CPU for the stride scheduler
+  uint64 pass;                 // ... and its virtual time
+  uint ticks;                  // timer ticks it has run for
+  uint affinity;               // harts it may run on, a bit each
+  int forking;                 // fork() is copying its memory; see preempt()
 
   // these are private to the process, so p->lock need not be held.
+  // a thread made by clone() uses the memory and open files
+  // of its group, the process that made it, so the fields
+  // marked "group" are only used in the group's proc.
+  struct proc *group;          // this proc, or the one whose memory it shares
+  int tslot;                   // trapframe at THREADTRAPFRAME(tslot)
+  struct proc *vfparent;       // the parent whose memory this vfork() child uses
+  struct proc *wakee;          // the one its last wakeup() woke; see sleep()
+  struct spinlock *droplock;   // preempt() may release and retake it
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // User page table
+  uint64 kstackstale;          // bit per hart that must flush kstack; see kstackfresh()
+  uint64 sz;                   // group: Size of process memory (bytes)
+  pagetable_t pagetable;       // User page table, the group's
+  pagetable_t kpagetable;      // Kernel page table, mirroring user memory
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
+  struct file *ofile[NOFILE];  // group: Open files
   struct inode *cwd;           // Current directory
+  struct inode *execip;        // group: Program file, for demand paging
+  struct seg seg[NSEG];        // group: Its loadable segments
+  int nseg;
+  struct vma vma[NVMA];        // group: mmap() regions
+
+  // group: the shared page table, the regions and the list
+  // of threads change under memlock; see clone() and mmstop().
+  struct spinlock memlock;
+  struct sleeplock mmlock;     // serializes changes to the layout
+  struct proc *mmstopper;      // the only thread allowed to run, if set
   char name[16];               // Process name (debugging)
+  void (*kfn)(void*);          // what a kernel thread runs; see kthread_create()
+  void *karg;                  // ... and its argument
+
+  // address space ID; see asidget().
+  uint64 asid;                 // tags p->pagetable's TLB entries
+  uint64 asidgen;              // generation asid belongs to, 0 if none
+  uint64 tlbstale;             // bit per hart that must flush asid
 
   uint64 mask;
 };
@@ -186,6 +186,10 @@ w_mtvec(uint64 x)
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
 
+// address space identifier, in satp bits 44..59.
+#define SATP_ASID(asid) (((uint64)(asid) & 0xFFFF) << 44)
+#define SATP2ASID(satp) (((satp) >> 44) & 0xFFFF)
+
 // supervisor address translation and protection;
 // holds the address of the page table.
 static inline void 
@@ -248,6 +252,21 @@ r_mcounteren()
   return x;
 }
 
+// Supervisor-mode Counter-Enable
+static inline void 
+w_scounteren(uint64 x)
+{
+  asm volatile("csrw scounteren, %0" : : "r" (x));
+}
+
+static inline uint64
+r_scounteren()
+{
+  uint64 x;
+  asm volatile("csrr %0, scounteren" : "=r" (x) );
+  return x;
+}
+
 // machine-mode cycle counter
 static inline uint64
 r_time()
@@ -319,6 +338,27 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries tagged with an address space.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid));
+}
+
+// flush the TLB entries for one address in one address space.
+static inline void
+sfence_vma_page(uint64 va, uint64 asid)
+{
+  asm volatile("sfence.vma %0, %1" : : "r" (va), "r" (asid));
+}
+
+// flush the TLB entries for one address in every address space.
+static inline void
+sfence_vma_va(uint64 va)
+{
+  asm volatile("sfence.vma %0, zero" : : "r" (va));
+}
+
 
 #define PGSIZE 4096 // bytes per page
 #define PGSHIFT 12  // bits of offset within a page
@@ -326,11 +366,23 @@ sfence_vma()
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
 
+#define SPGSIZE (PGSIZE*512) // bytes per superpage (a level-1 leaf)
+
+#define SPGROUNDUP(sz)  (((sz)+SPGSIZE-1) & ~(SPGSIZE-1))
+#define SPGROUNDDOWN(a) (((a)) & ~(SPGSIZE-1))
+
 #define PTE_V (1L << 0) // valid
 #define PTE_R (1L << 1)
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // 1 -> user can access
+#define PTE_A (1L << 6) // accessed
+#define PTE_D (1L << 7) // dirty
+// software bits, whose meaning depends on PTE_V:
+#define PTE_SWAP (1L << 8) // not valid: swapped out (see swap.c)
+#define PTE_ZRAM (1L << 9) // not valid: ... to compressed memory (see zram.c)
+#define PTE_COW  (1L << 8) // valid: merged by ksm.c, copy on write
+#define PTE_SWAPPED(pte) (((pte) & (PTE_V|PTE_SWAP)) == PTE_SWAP)
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -339,11 +391,24 @@ sfence_vma()
 
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
 
+// a PTE_SWAP entry keeps the page's R/W/X/U bits, and has
+// the swap slot (or, with PTE_ZRAM, the zram.c handle) where
+// the PPN would be.
+#define SLOT2PTE(slot) (((uint64)(slot)) << 10)
+#define PTE2SLOT(pte) ((int)((pte) >> 10))
+
+// a valid PTE with any of R, W, X set maps memory;
+// one with none of them points to the next level.
+#define PTE_LEAF(pte) ((pte) & (PTE_R|PTE_W|PTE_X))
+
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK          0x1FF // 9 bits
 #define PXSHIFT(level)  (PGSHIFT+(9*(level)))
 #define PX(level, va) ((((uint64) (va)) >> PXSHIFT(level)) & PXMASK)
 
+// bytes mapped by a leaf PTE at level.
+#define LEAFSIZE(level) (1L << PXSHIFT(level))
+
 // one beyond the highest possible virtual address.
 // MAXVA is actually one bit less than the max allowed by
 // Sv39, to avoid having to sign-extend virtual addresses
@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "defs.h"
 
@@ -42,6 +43,24 @@ acquire(struct spinlock *lk)
   lk->cpu = mycpu();
 }
 
+// Acquire the lock only if that needn't wait.
+// Returns 1 if it did, 0 if someone else holds it.
+int
+tryacquire(struct spinlock *lk)
+{
+  push_off();
+  if(holding(lk))
+    panic("tryacquire");
+
+  if(__sync_lock_test_and_set(&lk->locked, 1) != 0){
+    pop_off();
+    return 0;
+  }
+  __sync_synchronize();
+  lk->cpu = mycpu();
+  return 1;
+}
+
 // Release the lock.
 void
 release(struct spinlock *lk)
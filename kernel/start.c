@@ -16,10 +16,15 @@ uint64 mscratch0[NCPU * 32];
 // assembly code in kernelvec.S for machine-mode timer interrupt.
 extern void timervec();
 
-// entry.S jumps here in machine mode on stack0.
+// entry.S jumps here in machine mode on stack0,
+// with the device tree address from qemu in fdt.
 void
-start()
+start(uint64 hartid, uint64 fdt)
 {
+  // remember where the device tree is, for fdtinit().
+  if(hartid == 0)
+    fdtaddr = fdt;
+
   // set M Previous Privilege mode to Supervisor, for mret.
   unsigned long x = r_mstatus();
   x &= ~MSTATUS_MPP_MASK;
@@ -38,6 +43,10 @@ start()
   w_mideleg(0xffff);
   w_sie(r_sie() | SIE_SEIE | SIE_STIE | SIE_SSIE);
 
+  // let supervisor mode read the time CSR, and pass that on
+  // to user mode (see trapinithart()).
+  w_mcounteren(r_mcounteren() | 2);
+
   // ask for clock interrupts.
   timerinit();
 
@@ -49,27 +58,29 @@ start()
   asm volatile("mret");
 }
 
-// set up to receive timer interrupts in machine mode,
-// which arrive at timervec in kernelvec.S,
-// which turns them into software interrupts for
-// devintr() in trap.c.
+// set up to receive timer interrupts, and software interrupts
+// from other harts (see kickidle()), in machine mode, which
+// arrive at timervec in kernelvec.S, which turns them into
+// supervisor software interrupts for devintr() in trap.c.
 void
 timerinit()
 {
   // each CPU has a separate source of timer interrupts.
   int id = r_mhartid();
 
-  // ask the CLINT for a timer interrupt.
-  int interval = 1000000; // cycles; about 1/10th second in qemu.
-  *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
+  // ask the CLINT for a timer interrupt; timerintr() in
+  // trap.c sets each one after that.
+  *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + TICKCYCLES;
 
   // prepare information in scratch[] for timervec.
   // scratch[0..3] : space for timervec to save registers.
   // scratch[4] : address of CLINT MTIMECMP register.
-  // scratch[5] : desired interval (in cycles) between timer interrupts.
+  // scratch[5] : set by timervec when the timer goes off, cleared by devintr().
+  // scratch[6] : address of CLINT MSIP register.
   uint64 *scratch = &mscratch0[32 * id];
   scratch[4] = CLINT_MTIMECMP(id);
-  scratch[5] = interval;
+  scratch[5] = 0;
+  scratch[6] = CLINT_MSIP(id);
   w_mscratch((uint64)scratch);
 
   // set the machine-mode trap handler.
@@ -78,6 +89,6 @@ timerinit()
   // enable machine-mode interrupts.
   w_mstatus(r_mstatus() | MSTATUS_MIE);
 
-  // enable machine-mode timer interrupts.
-  w_mie(r_mie() | MIE_MTIE);
+  // enable machine-mode timer and software interrupts.
+  w_mie(r_mie() | MIE_MTIE | MIE_MSIE);
 }
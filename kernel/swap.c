@@ -0,0 +1,277 @@
+//
+// swapping user pages to the swap area that mkfs lays out
+// after the file system.
+//
+// when kalloc() runs dry, ukalloc() calls swapreclaim(),
+// which runs a clock hand over the user page tables of all
+// processes. a page whose PTE_A is set has its bit cleared
+// and gets a second chance; one that is still clear the next
+// time around is compressed into memory by zstore() if it
+// compresses well (see zram.c), and otherwise written to a
+// free slot of the swap area. its PTE becomes a PTE_SWAP
+// entry naming the slot, or with PTE_ZRAM, the zram handle.
+// vmfault() reads it back in with swapin().
+//
+// only 4096-byte pages below p->sz that no other page table
+// shares are swapped, and none from a process with threads
+// (see clone()), which would all have to be stopped, or
+// whose page table a vfork() child borrows. the
+// hand only takes a page from a
+// process that isn't running, while holding its p->lock, so
+// a process's kernel code must not hold on to the physical
+// address of one of its pages across a point where it could
+// be preempted or sleep; see uvmaddr() and kvmmirror().
+//
+// a slot may be named by more than one PTE after fork();
+// ref counts them. a slot is free when its ref is zero and
+// it isn't still being written.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sysinfo.h"
+#include "defs.h"
+
+#define SLOTBLOCKS (PGSIZE / BSIZE)       // disk blocks per page
+#define NSLOT      (SWAPSIZE / SLOTBLOCKS)
+#define SWAPBATCH  8                      // pages swapped out per shortage
+
+extern struct proc *allproc;
+extern struct superblock sb;
+
+struct {
+  struct spinlock lock;
+  uint start;           // first block of the swap area
+  int nslot;            // slots in it, 0 if there's none
+  int next;             // where swapalloc() looks first
+  ushort ref[NSLOT];    // PTEs naming each slot
+  uchar busy[NSLOT];    // being written out
+  uint64 nin;           // pages swapped in
+  uint64 nout;          // pages swapped out
+} swap;
+
+// the clock hand: the next page swapvictim() looks at.
+struct {
+  struct spinlock lock;
+  struct proc *proc;    // 0 means allproc's head
+  uint64 va;
+} hand;
+
+// Called by fsinit(), once the superblock has been read.
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+  initlock(&hand.lock, "swaphand");
+  swap.start = sb.swapstart;
+  swap.nslot = sb.nswap / SLOTBLOCKS;
+  if(swap.nslot > NSLOT)
+    swap.nslot = NSLOT;
+}
+
+// Take a free slot, marked busy. Caller must hold swap.lock.
+static int
+swapalloc(void)
+{
+  for(int i = 0; i < swap.nslot; i++){
+    int s = (swap.next + i) % swap.nslot;
+    if(swap.ref[s] == 0 && !swap.busy[s]){
+      swap.ref[s] = 1;
+      swap.busy[s] = 1;
+      swap.next = s + 1;
+      return s;
+    }
+  }
+  return -1;
+}
+
+// Another PTE is a copy of the PTE_SWAP entry pte; see uvmcopy().
+void
+swapdup(pte_t pte)
+{
+  int slot = PTE2SLOT(pte);
+
+  if(pte & PTE_ZRAM){
+    zdup(slot);
+    return;
+  }
+  acquire(&swap.lock);
+  if(swap.ref[slot] == 0 || swap.ref[slot] == 0xFFFF)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// The PTE_SWAP entry pte is going away.
+void
+swapfree(pte_t pte)
+{
+  int slot = PTE2SLOT(pte);
+
+  if(pte & PTE_ZRAM){
+    zfree(slot);
+    return;
+  }
+  acquire(&swap.lock);
+  if(swap.ref[slot] == 0)
+    panic("swapfree");
+  swap.ref[slot]--;
+  release(&swap.lock);
+}
+
+// Advance the clock hand to a page to swap out and take it
+// from its process, whose PTE becomes a PTE_SWAP entry.
+// Returns the entry, and in *pa the page, which the caller
+// now owns; it must write it to the entry's slot, unless the
+// entry is PTE_ZRAM, in which case the page is already stored
+// (and *pa is 0 if it became a zram slab). Returns 0 if the
+// hand went around twice without finding a page.
+static pte_t
+swapvictim(uint64 *pa)
+{
+  struct proc *p;
+  pte_t *pte, entry = 0;
+  uint64 va, flags;
+  int level, slot, kept, laps = 0;
+
+  acquire(&hand.lock);
+  while(entry == 0 && laps < 2){
+    if(hand.proc == 0)
+      hand.proc = allproc;
+    p = hand.proc;
+    acquire(&p->lock);
+    if(p->pagetable == 0 || p->group != p || p->nthread > 0 ||
+       p->vfparent || p->vfchild || p->forking ||
+       (p->state != SLEEPING && p->state != RUNNABLE && p != myproc()))
+      hand.va = p->sz;
+    for(; entry == 0 && hand.va < p->sz; hand.va += PGSIZE){
+      va = hand.va;
+      level = 0;
+      if((pte = walklevel(p->pagetable, va, 0, &level)) == 0 || level > 0){
+        // nothing mapped here, or a superpage; skip it.
+        hand.va = SPGROUNDDOWN(va) + SPGSIZE - PGSIZE;
+        continue;
+      }
+      if((*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U) || krefs((void*)PTE2PA(*pte)) != 1)
+        continue;
+      if(*pte & PTE_A){
+        // used since the hand last came by.
+        *pte &= ~PTE_A;
+        proc_tlbinval(p, va, 1);
+        continue;
+      }
+      *pa = PTE2PA(*pte);
+      flags = PTE_SWAP | (PTE_FLAGS(*pte) & (PTE_R|PTE_W|PTE_X|PTE_U));
+      if(*pte & PTE_COW)
+        flags |= PTE_W;   // merged, but no longer shared; see ksm.c.
+      if((slot = zstore((void*)*pa, &kept)) >= 0){
+        entry = SLOT2PTE(slot) | PTE_ZRAM | flags;
+        if(kept)
+          *pa = 0;
+      } else {
+        acquire(&swap.lock);
+        slot = swapalloc();
+        release(&swap.lock);
+        if(slot < 0)
+          continue;   // swap is full; look for a page that compresses.
+        entry = SLOT2PTE(slot) | flags;
+      }
+      *pte = entry;
+      proc_tlbinval(p, va, 1);
+    }
+    if(hand.va >= p->sz){
+      hand.va = 0;
+      if((hand.proc = p->allnext) == 0)
+        laps++;
+    }
+    release(&p->lock);
+  }
+  release(&hand.lock);
+  return entry;
+}
+
+// Swap out up to n pages. Returns how many it freed.
+// Sleeps; must not be called holding a spinlock.
+int
+swapreclaim(int n)
+{
+  uint64 pa;
+  pte_t entry;
+  int slot, got = 0;
+
+  while(got < n && (entry = swapvictim(&pa)) != 0){
+    slot = PTE2SLOT(entry);
+    if((entry & PTE_ZRAM) == 0)
+      virtio_disk_rwpage(swap.start + slot*SLOTBLOCKS, (void*)pa, 1);
+    acquire(&swap.lock);
+    if((entry & PTE_ZRAM) == 0){
+      swap.busy[slot] = 0;
+      wakeup(&swap.busy[slot]);
+    }
+    swap.nout++;
+    release(&swap.lock);
+    if(pa){
+      kfree((void*)pa);
+      got++;
+    }
+  }
+  return got;
+}
+
+// Read p's page at va back in from where its PTE says.
+// Called by vmfault(), in p.
+int
+swapin(struct proc *p, uint64 va, pte_t *pte)
+{
+  pte_t old = *pte;
+  int slot = PTE2SLOT(old);
+  char *mem;
+
+  if((mem = ukalloc()) == 0)
+    return -1;
+  if(old & PTE_ZRAM){
+    zload(slot, mem);
+  } else {
+    // the page may not have reached the disk yet.
+    acquire(&swap.lock);
+    while(swap.busy[slot])
+      sleep(&swap.busy[slot], &swap.lock);
+    release(&swap.lock);
+    virtio_disk_rwpage(swap.start + slot*SLOTBLOCKS, mem, 0);
+    swapfree(old);
+  }
+
+  acquire(&swap.lock);
+  swap.nin++;
+  release(&swap.lock);
+  *pte = PA2PTE(mem) | (PTE_FLAGS(old) & ~(PTE_SWAP|PTE_ZRAM)) | PTE_V;
+  return 0;
+}
+
+// Allocate a page for user memory like kalloc(), but if
+// there is none, swap user pages out to make room.
+// Sleeps; must not be called holding a spinlock.
+void *
+ukalloc(void)
+{
+  void *pa;
+
+  while((pa = kalloc()) == 0)
+    if(swapreclaim(SWAPBATCH) == 0)
+      return 0;
+  return pa;
+}
+
+void countSwap(void* ptr) {
+  struct sysinfo* inf = (struct sysinfo*)ptr;
+  acquire(&swap.lock);
+  inf->nswapin = swap.nin;
+  inf->nswapout = swap.nout;
+  release(&swap.lock);
+}
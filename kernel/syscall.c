@@ -3,6 +3,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "syscall.h"
 #include "defs.h"
@@ -12,7 +13,7 @@ int
 fetchaddr(uint64 addr, uint64 *ip)
 {
   struct proc *p = myproc();
-  if(addr >= p->sz || addr+sizeof(uint64) > p->sz)
+  if(addr >= p->group->sz || addr+sizeof(uint64) > p->group->sz)
     return -1;
   if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
@@ -106,6 +107,19 @@ extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
 extern uint64 sys_trace(void); // Add
 extern uint64 sys_sysinfo(void); // Add
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_futex(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_vfork(void);
+extern uint64 sys_settickets(void);
+extern uint64 sys_getticks(void);
+extern uint64 sys_sched_setaffinity(void);
+extern uint64 sys_sched_getaffinity(void);
+extern uint64 sys_nanosleep(void);
+extern uint64 sys_uptimens(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -131,6 +145,19 @@ static uint64 (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_trace]   sys_trace,
 [SYS_sysinfo] sys_sysinfo,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex]   sys_futex,
+[SYS_spawn]   sys_spawn,
+[SYS_vfork]   sys_vfork,
+[SYS_settickets] sys_settickets,
+[SYS_getticks] sys_getticks,
+[SYS_sched_setaffinity] sys_sched_setaffinity,
+[SYS_sched_getaffinity] sys_sched_getaffinity,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_uptimens] sys_uptimens,
 };
 
 static char* syscalls_names[] = {
@@ -157,6 +184,19 @@ static char* syscalls_names[] = {
 [SYS_close]   "close",
 [SYS_trace]   "trace",  // Add
 [SYS_sysinfo]   "sysinfo",  // Add
+[SYS_mmap]    "mmap",
+[SYS_munmap]  "munmap",
+[SYS_clone]   "clone",
+[SYS_join]    "join",
+[SYS_futex]   "futex",
+[SYS_spawn]   "spawn",
+[SYS_vfork]   "vfork",
+[SYS_settickets] "settickets",
+[SYS_getticks] "getticks",
+[SYS_sched_setaffinity] "sched_setaffinity",
+[SYS_sched_getaffinity] "sched_getaffinity",
+[SYS_nanosleep] "nanosleep",
+[SYS_uptimens] "uptimens",
 };
 
 void
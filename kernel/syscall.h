@@ -22,3 +22,16 @@
 #define SYS_close  21
 #define SYS_trace  22 // Add
 #define SYS_sysinfo  23 // Add
+#define SYS_mmap   24
+#define SYS_munmap 25
+#define SYS_clone  26
+#define SYS_join   27
+#define SYS_futex  28
+#define SYS_spawn  29
+#define SYS_vfork  30
+#define SYS_settickets 31
+#define SYS_getticks 32
+#define SYS_sched_setaffinity 33
+#define SYS_sched_getaffinity 34
+#define SYS_nanosleep 35
+#define SYS_uptimens 36
@@ -10,45 +10,58 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "fs.h"
-#include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
+// The file comes with a reference of its own, since another thread
+// may close the descriptor meanwhile; drop it with fileclose().
 static int
 argfd(int n, int *pfd, struct file **pf)
 {
   int fd;
   struct file *f;
+  struct proc *g = myproc()->group;
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(fd < 0 || fd >= NOFILE)
+    return -1;
+  acquire(&g->lock);
+  if((f = g->ofile[fd]) == 0){
+    release(&g->lock);
     return -1;
+  }
+  filedup(f);
+  release(&g->lock);
   if(pfd)
     *pfd = fd;
-  if(pf)
-    *pf = f;
+  *pf = f;
   return 0;
 }
 
 // Allocate a file descriptor for the given file.
 // Takes over file reference from caller on success.
+// The table may be shared by threads, hence the lock.
 static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *p = myproc();
+  struct proc *g = myproc()->group;
 
+  acquire(&g->lock);
   for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
+    if(g->ofile[fd] == 0){
+      g->ofile[fd] = f;
+      release(&g->lock);
       return fd;
     }
   }
+  release(&g->lock);
   return -1;
 }
 
@@ -58,11 +71,13 @@ sys_dup(void)
   struct file *f;
   int fd;
 
+  // the reference from argfd() goes to the new descriptor.
   if(argfd(0, 0, &f) < 0)
     return -1;
-  if((fd=fdalloc(f)) < 0)
+  if((fd=fdalloc(f)) < 0){
+    fileclose(f);
     return -1;
-  filedup(f);
+  }
   return fd;
 }
 
@@ -70,25 +85,29 @@ uint64
 sys_read(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   uint64 p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
+  if(argint(2, &n) < 0 || argaddr(1, &p) < 0 || argfd(0, 0, &f) < 0)
     return -1;
-  return fileread(f, p, n);
+  r = fileread(f, p, n);
+  fileclose(f);
+  return r;
 }
 
 uint64
 sys_write(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   uint64 p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
+  if(argint(2, &n) < 0 || argaddr(1, &p) < 0 || argfd(0, 0, &f) < 0)
     return -1;
 
-  return filewrite(f, p, n);
+  r = filewrite(f, p, n);
+  fileclose(f);
+  return r;
 }
 
 uint64
@@ -96,10 +115,19 @@ sys_close(void)
 {
   int fd;
   struct file *f;
+  struct proc *g = myproc()->group;
 
-  if(argfd(0, &fd, &f) < 0)
+  if(argint(0, &fd) < 0 || fd < 0 || fd >= NOFILE)
+    return -1;
+  // check and clear the slot in one step, so that two threads
+  // closing fd can't both close its file.
+  acquire(&g->lock);
+  if((f = g->ofile[fd]) == 0){
+    release(&g->lock);
     return -1;
-  myproc()->ofile[fd] = 0;
+  }
+  g->ofile[fd] = 0;
+  release(&g->lock);
   fileclose(f);
   return 0;
 }
@@ -109,10 +137,13 @@ sys_fstat(void)
 {
   struct file *f;
   uint64 st; // user pointer to struct stat
+  int r;
 
-  if(argfd(0, 0, &f) < 0 || argaddr(1, &st) < 0)
+  if(argaddr(1, &st) < 0 || argfd(0, 0, &f) < 0)
     return -1;
-  return filestat(f, st);
+  r = filestat(f, st);
+  fileclose(f);
+  return r;
 }
 
 // Create the path new as a link to the same inode as old.
@@ -412,19 +443,26 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+static void
+freeargv(char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
 
-  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  for(i = 0; i < MAXARG && argv[i] != 0; i++)
+    kfree(argv[i]);
+}
+
+// Fetch the user's argv array at uargv into argv, a page
+// per string. Returns 0, or -1 having freed what it got.
+static int
+fetchargv(uint64 uargv, char **argv)
+{
+  int i;
+  uint64 uarg;
+
+  memset(argv, 0, MAXARG*sizeof(argv[0]));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
+    if(i >= MAXARG){
       goto bad;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
@@ -440,18 +478,52 @@ sys_exec(void)
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
       goto bad;
   }
+  return 0;
 
-  int ret = exec(path, argv);
+ bad:
+  freeargv(argv);
+  return -1;
+}
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+  int ret;
 
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+  ret = exec(path, argv);
+  freeargv(argv);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+// spawn(path, argv, fdmap, nfd): see spawn() in proc.c.
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  int fdmap[NOFILE], nfd, ret;
+  uint64 uargv, ufdmap;
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0 ||
+     argaddr(2, &ufdmap) < 0 || argint(3, &nfd) < 0)
+    return -1;
+  if(ufdmap != 0){
+    if(nfd < 0 || nfd > NOFILE)
+      return -1;
+    if(copyin(myproc()->pagetable, (char*)fdmap, ufdmap, nfd*sizeof(int)) < 0)
+      return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+  ret = spawn(path, argv, ufdmap ? fdmap : 0, nfd);
+  freeargv(argv);
+  return ret;
 }
 
 uint64
@@ -469,18 +541,59 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
+      p->group->ofile[fd0] = 0;
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+    p->group->ofile[fd0] = 0;
+    p->group->ofile[fd1] = 0;
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   return 0;
 }
+
+uint64
+sys_mmap(void)
+{
+  uint64 addr, len, off;
+  int prot, flags;
+  struct file *f = 0;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argaddr(5, &off) < 0)
+    return -1;
+  // addr is only a hint, which we don't take.
+  if(((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+    return -1;
+  if((flags & MAP_ANONYMOUS) == 0){
+    if(argfd(4, 0, &f) < 0)
+      return -1;
+    if(f->type != FD_INODE || !f->readable ||
+       ((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)){
+      fileclose(f);
+      return -1;
+    }
+  }
+  // the region takes a reference of its own.
+  addr = vmaalloc(myproc(), len, prot, flags, f, off);
+  if(f)
+    fileclose(f);
+  if(addr == 0)
+    return -1;
+  return addr;
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0)
+    return -1;
+  return vmaunmap(myproc(), addr, len);
+}
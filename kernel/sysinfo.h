@@ -1,4 +1,11 @@
 struct sysinfo {
   uint64 freemem;   // amount of free memory (bytes)
   uint64 nproc;     // number of process
+  uint64 nswapin;   // pages swapped in
+  uint64 nswapout;  // pages swapped out
+  uint64 nzstored;  // swapped-out pages kept compressed in memory
+  uint64 nzbytes;   // ... their compressed size (bytes)
+  uint64 nzpages;   // ... and the memory holding them (pages)
+  uint64 nksm;      // pages saved by merging identical ones
+  uint64 nkpt;      // page-table pages in the kernel's page table
 };
@@ -5,8 +5,10 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "sysinfo.h"
+#include "fcntl.h"
 
 uint64
 sys_exit(void)
@@ -30,6 +32,12 @@ sys_fork(void)
   return fork();
 }
 
+uint64
+sys_vfork(void)
+{
+  return vfork();
+}
+
 uint64
 sys_wait(void)
 {
@@ -39,6 +47,44 @@ sys_wait(void)
   return wait(p);
 }
 
+uint64
+sys_clone(void)
+{
+  uint64 fn, stack;
+  int flags;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &stack) < 0 || argint(2, &flags) < 0)
+    return -1;
+  return clone(fn, stack, flags);
+}
+
+uint64
+sys_join(void)
+{
+  int tid;
+
+  if(argint(0, &tid) < 0)
+    return -1;
+  return join(tid);
+}
+
+uint64
+sys_futex(void)
+{
+  uint64 addr;
+  int op, val;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &op) < 0 || argint(2, &val) < 0)
+    return -1;
+  switch(op){
+  case FUTEX_WAIT:
+    return futexwait(addr, val);
+  case FUTEX_WAKE:
+    return futexwake(addr, val);
+  }
+  return -1;
+}
+
 uint64
 sys_sbrk(void)
 {
@@ -47,7 +93,7 @@ sys_sbrk(void)
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
+  addr = myproc()->group->sz;
   if(growproc(n) < 0)
     return -1;
   return addr;
@@ -74,6 +120,16 @@ sys_sleep(void)
   return 0;
 }
 
+uint64
+sys_nanosleep(void)
+{
+  uint64 ns;
+
+  if(argaddr(0, &ns) < 0)
+    return -1;
+  return nanosleep(ns);
+}
+
 uint64
 sys_kill(void)
 {
@@ -84,6 +140,46 @@ sys_kill(void)
   return kill(pid);
 }
 
+uint64
+sys_settickets(void)
+{
+  int n;
+
+  if(argint(0, &n) < 0)
+    return -1;
+  return settickets(n);
+}
+
+uint64
+sys_getticks(void)
+{
+  int pid;
+
+  if(argint(0, &pid) < 0)
+    return -1;
+  return getticks(pid);
+}
+
+uint64
+sys_sched_setaffinity(void)
+{
+  int pid, mask;
+
+  if(argint(0, &pid) < 0 || argint(1, &mask) < 0)
+    return -1;
+  return sched_setaffinity(pid, mask);
+}
+
+uint64
+sys_sched_getaffinity(void)
+{
+  int pid;
+
+  if(argint(0, &pid) < 0)
+    return -1;
+  return sched_getaffinity(pid);
+}
+
 // return how many clock tick interrupts have occurred
 // since start.
 uint64
@@ -97,6 +193,13 @@ sys_uptime(void)
   return xticks;
 }
 
+// return nanoseconds since start.
+uint64
+sys_uptimens(void)
+{
+  return uptimens();
+}
+
 // Add
 uint64
 sys_trace(void)
@@ -117,6 +220,10 @@ sys_sysinfo(void)
 
   countMem(&inf);
   countProc(&inf);
+  countSwap(&inf);
+  countZram(&inf);
+  countKsm(&inf);
+  countKvm(&inf);
 
   // 结构体从内核区复制到用户区
   struct proc *p = myproc();
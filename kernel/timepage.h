@@ -0,0 +1,17 @@
+// The kernel maps this page read-only at TIMEPAGE in every
+// process, so that clock_gettime() in user/ulib.c can tell the
+// time without a system call: it reads the time CSR, which
+// counts at timebase per second from boot, itself.
+struct timepage {
+  uint ticks;        // timer ticks since boot, as uptime() returns
+  uint64 timebase;   // time CSR counts per second
+  uint64 realbase;   // ns since 1970 when the time CSR was 0; 0 if unknown
+};
+
+#define CLOCK_REALTIME   0  // since 1970
+#define CLOCK_MONOTONIC  1  // since boot
+
+struct timespec {
+  uint64 sec;
+  uint64 nsec;
+};
@@ -3,12 +3,24 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "defs.h"
+#include "timepage.h"
 
 struct spinlock tickslock;
 uint ticks;
 
+// shared read-only with every process; see timepage.h.
+struct timepage *timepage;
+
+// timervec's per-hart scratch areas; see timerinit().
+extern uint64 mscratch0[];
+#define SCRATCH(i) (&mscratch0[32 * cpuid() + (i)])
+#define SC_FIRED    5
+
+#define NSPERCYCLE (1000000000L / TIMEBASE)
+
 extern char trampoline[], uservec[], userret[];
 
 // in kernelvec.S, calls kerneltrap().
@@ -16,10 +28,34 @@ void kernelvec();
 
 extern int devintr();
 
+// ns since 1970, from qemu's RTC.
+static uint64
+rtcread(void)
+{
+  uint64 lo, hi;
+
+  // reading TIME_LOW latches TIME_HIGH.
+  lo = *(volatile uint32*)RTC0_TIME_LOW;
+  hi = *(volatile uint32*)RTC0_TIME_HIGH;
+  return (hi << 32) | lo;
+}
+
 void
 trapinit(void)
 {
+  struct cpu *c;
+  uint64 real;
+
   initlock(&tickslock, "time");
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    initlock(&c->timerlock, "timer");
+
+  if((timepage = kalloc()) == 0)
+    panic("trapinit: timepage");
+  memset(timepage, 0, PGSIZE);
+  timepage->timebase = TIMEBASE;
+  if((real = rtcread()) != 0)
+    timepage->realbase = real - uptimens();
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -27,6 +63,9 @@ void
 trapinithart(void)
 {
   w_stvec((uint64)kernelvec);
+
+  // let user mode read the time CSR, for clock_gettime().
+  w_scounteren(r_scounteren() | 2);
 }
 
 //
@@ -65,6 +104,17 @@ usertrap(void)
     intr_on();
 
     syscall();
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // page fault: maybe a page exec() left to be loaded
+    // on demand. that may sleep, so allow interrupts.
+    uint64 va = r_stval();
+    int write = r_scause() == 15;
+    intr_on();
+    if(vmfault(p, va, write) < 0){
+      printf("usertrap(): page fault %p pid=%d\n", va, p->pid);
+      printf("            sepc=%p\n", p->trapframe->epc);
+      p->killed = 1;
+    }
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
@@ -78,7 +128,7 @@ usertrap(void)
 
   // give up the CPU if this is a timer interrupt.
   if(which_dev == 2)
-    yield();
+    timeryield();
 
   usertrapret();
 }
@@ -101,7 +151,7 @@ usertrapret(void)
 
   // set up trapframe values that uservec will need when
   // the process next re-enters the kernel.
-  p->trapframe->kernel_satp = r_satp();         // kernel page table
+  p->trapframe->kernel_satp = proc_ksatp(p);    // process's kernel page table
   p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
   p->trapframe->kernel_trap = (uint64)usertrap;
   p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
@@ -118,14 +168,19 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // tell trampoline.S the user page table to switch to,
+  // and whether it must flush the TLB for lack of an ASID.
+  uint64 asid = asidget(p);
+  uint64 satp = MAKE_SATP(p->pagetable) | SATP_ASID(asid);
+
+  // ... and uservec whether it must on the way back in.
+  p->trapframe->kernel_flush = asid == 0;
 
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64,uint64))fn)(THREADTRAPFRAME(p->tslot), satp, asid == 0);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -134,6 +189,7 @@ void
 kerneltrap()
 {
   int which_dev = 0;
+  uint64 resume;
   uint64 sepc = r_sepc();
   uint64 sstatus = r_sstatus();
   uint64 scause = r_scause();
@@ -143,7 +199,10 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if((which_dev = devintr()) == 0){
+  if((scause == 13 || scause == 15) && (resume = uaccessfault(sepc)) != 0){
+    // a copy to or from user memory; see vmcopyin.c.
+    sepc = resume;
+  } else if((which_dev = devintr()) == 0){
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
@@ -151,7 +210,7 @@ kerneltrap()
 
   // give up the CPU if this is a timer interrupt.
   if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
-    yield();
+    timeryield();
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -164,10 +223,163 @@ clockintr()
 {
   acquire(&tickslock);
   ticks++;
+  timepage->ticks = ticks;
   wakeup(&ticks);
   release(&tickslock);
 }
 
+static uint64
+mtime(void)
+{
+  return *(uint64*)KCLINT_MTIME;
+}
+
+// Set hart c's timer for its next tick or the soonest
+// nanosleep() deadline on it, whichever comes first. timervec
+// turns the timer off each time it goes off, so this is how
+// every timer interrupt after the first is asked for.
+// Caller must hold c->timerlock.
+static void
+armtimer(struct cpu *c)
+{
+  uint64 when = -1;
+
+  if(!c->tickless)
+    when = c->nexttick;
+  if(c->timers && c->timers->wakeat < when)
+    when = c->timers->wakeat;
+  *(uint64*)KCLINT_MTIMECMP(c - cpus) = when;
+}
+
+// This hart's timer went off: tick if one is due, and wake
+// the processes whose nanosleep() deadlines have passed.
+// Returns 1 for a tick.
+static int
+timerintr(void)
+{
+  struct cpu *c = mycpu();
+  struct proc *p;
+  uint64 now = mtime();
+  int tick = 0;
+
+  acquire(&c->timerlock);
+  if(!c->tickless && now >= c->nexttick){
+    tick = 1;
+    c->needresched = 1;
+    // drop ticks that interrupts being off made us miss.
+    c->nexttick += TICKCYCLES;
+    if(c->nexttick <= now)
+      c->nexttick = now + TICKCYCLES;
+  }
+  while((p = c->timers) != 0 && p->wakeat <= now){
+    c->timers = p->timernext;
+    p->timercpu = 0;
+    acquire(&p->lock);
+    if(p->state == SLEEPING && p->chan == &p->wakeat)
+      makerunnable(p);
+    release(&p->lock);
+  }
+  armtimer(c);
+  release(&c->timerlock);
+
+  if(tick && c == cpus)
+    clockintr();
+  return tick;
+}
+
+// Turn off this hart's ticks while it idles, so that it sleeps
+// in wfi until a device, a nanosleep() deadline or another hart
+// (see kickidle()) interrupts it, rather than waking for every
+// tick. Hart 0 keeps ticking, since it keeps ticks.
+void
+ticksoff(void)
+{
+  struct cpu *c;
+
+  push_off();
+  c = mycpu();
+  if(c != cpus){
+    acquire(&c->timerlock);
+    c->tickless = 1;
+    armtimer(c);
+    release(&c->timerlock);
+  }
+  pop_off();
+}
+
+// Turn ticks back on after ticksoff().
+void
+tickson(void)
+{
+  struct cpu *c;
+  uint64 now;
+
+  push_off();
+  c = mycpu();
+  if(c->tickless){
+    acquire(&c->timerlock);
+    c->tickless = 0;
+    now = mtime();
+    if(c->nexttick <= now)
+      c->nexttick = now + TICKCYCLES;
+    armtimer(c);
+    release(&c->timerlock);
+  }
+  pop_off();
+}
+
+// Sleep for ns nanoseconds. The deadline goes on this hart's
+// timer, which goes off for it alone, so the caller wakes then
+// rather than at the next tick, to within a CLINT_MTIME cycle
+// if a hart is free to run it.
+// Returns -1 if killed.
+int
+nanosleep(uint64 ns)
+{
+  struct proc *p = myproc(), **pp;
+  struct cpu *c;
+  uint64 now, when;
+
+  push_off();
+  c = mycpu();
+  acquire(&c->timerlock);
+  pop_off();
+
+  // round up, so as never to wake early.
+  now = mtime();
+  when = now + ns / NSPERCYCLE + (ns % NSPERCYCLE != 0);
+  if(when < now)
+    when = -2;
+
+  p->wakeat = when;
+  for(pp = &c->timers; *pp && (*pp)->wakeat <= when; pp = &(*pp)->timernext)
+    ;
+  p->timernext = *pp;
+  *pp = p;
+  p->timercpu = c;
+  if(c->timers == p)
+    armtimer(c);
+
+  // timerintr() takes p off the list when it wakes p.
+  while(p->timercpu && !p->killed)
+    sleep(&p->wakeat, &c->timerlock);
+  if(p->timercpu){
+    for(pp = &c->timers; *pp != p; pp = &(*pp)->timernext)
+      ;
+    *pp = p->timernext;
+    p->timercpu = 0;
+  }
+  release(&c->timerlock);
+  return p->killed ? -1 : 0;
+}
+
+// Nanoseconds since boot.
+uint64
+uptimens(void)
+{
+  return mtime() * NSPERCYCLE;
+}
+
 // check if it's an external interrupt or software interrupt,
 // and handle it.
 // returns 2 if timer interrupt,
@@ -202,17 +414,18 @@ devintr()
     return 1;
   } else if(scause == 0x8000000000000001L){
     // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // or from another hart's kickidle(), forwarded by timervec
+    // in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
 
-    return 2;
+    // a kick only had to wake the hart.
+    if(__sync_lock_test_and_set(SCRATCH(SC_FIRED), 0) == 0)
+      return 1;
+
+    return timerintr() ? 2 : 1;
   } else {
     return 0;
   }
@@ -7,7 +7,9 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
+#include "workqueue.h"
 #include "defs.h"
 
 // the UART control registers are memory-mapped
@@ -45,9 +47,19 @@ char uart_tx_buf[UART_TX_BUF_SIZE];
 int uart_tx_w; // write next to uart_tx_buf[uart_tx_w++]
 int uart_tx_r; // read next from uart_tx_buf[uar_tx_r++]
 
+// input that uartintr() has read, for uartrx() to hand
+// to the console.
+struct spinlock uart_rx_lock;
+#define UART_RX_BUF_SIZE 32
+char uart_rx_buf[UART_RX_BUF_SIZE];
+int uart_rx_w; // write next to uart_rx_buf[uart_rx_w++]
+int uart_rx_r; // read next from uart_rx_buf[uart_rx_r++]
+struct work uart_rx_work;
+
 extern volatile int panicked; // from printf.c
 
 void uartstart();
+void uartrx(void*);
 
 void
 uartinit(void)
@@ -75,6 +87,8 @@ uartinit(void)
   WriteReg(IER, IER_TX_ENABLE | IER_RX_ENABLE);
 
   initlock(&uart_tx_lock, "uart");
+  initlock(&uart_rx_lock, "uartrx");
+  initwork(&uart_rx_work, uartrx, 0);
 }
 
 // add a character to the output buffer and tell the
@@ -179,16 +193,40 @@ uartgetc(void)
 void
 uartintr(void)
 {
-  // read and process incoming characters.
-  while(1){
+  // read incoming characters, and have a worker process them,
+  // since consoleintr() echoes them and may print a lot.
+  acquire(&uart_rx_lock);
+  while(uart_rx_w != uart_rx_r + UART_RX_BUF_SIZE){
     int c = uartgetc();
     if(c == -1)
       break;
-    consoleintr(c);
+    uart_rx_buf[uart_rx_w++ % UART_RX_BUF_SIZE] = c;
   }
+  // if the worker has fallen behind, leave the rest in the
+  // uart's FIFO, and turn off receive interrupts, which it
+  // would otherwise keep raising, until uartrx() makes room.
+  if(uart_rx_w == uart_rx_r + UART_RX_BUF_SIZE)
+    WriteReg(IER, IER_TX_ENABLE);
+  if(uart_rx_w != uart_rx_r)
+    queue_work(WQ_INTR, &uart_rx_work);
+  release(&uart_rx_lock);
 
   // send buffered characters.
   acquire(&uart_tx_lock);
   uartstart();
   release(&uart_tx_lock);
 }
+
+// hand the characters uartintr() read to the console, in
+// order, even if workers on two harts get here at once.
+// runs on a WQ_INTR worker.
+void
+uartrx(void *arg)
+{
+  acquire(&uart_rx_lock);
+  while(uart_rx_r != uart_rx_w)
+    consoleintr(uart_rx_buf[uart_rx_r++ % UART_RX_BUF_SIZE]);
+  // there's room again for what's waiting in the FIFO.
+  WriteReg(IER, IER_TX_ENABLE | IER_RX_ENABLE);
+  release(&uart_rx_lock);
+}
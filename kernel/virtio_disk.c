@@ -16,6 +16,9 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "workqueue.h"
+
+static void virtio_disk_done(void*);
 
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
@@ -38,9 +41,15 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    int *busy;     // cleared when the operation is done
     char status;
   } info[NUM];
+
+  // finished operations whose waiters virtio_disk_done()
+  // has yet to wake up.
+  int *done[NUM];
+  int ndone;
+  struct work donework;
   
   struct spinlock vdisk_lock;
   
@@ -52,6 +61,7 @@ virtio_disk_init(void)
   uint32 status = 0;
 
   initlock(&disk.vdisk_lock, "virtio_disk");
+  initwork(&disk.donework, virtio_disk_done, 0);
 
   if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
      *R(VIRTIO_MMIO_VERSION) != 1 ||
@@ -165,11 +175,12 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// Read or write len bytes at data, which must be
+// direct-mapped, from or to the disk starting at sector,
+// sleeping until the disk is done and sets *busy to 0.
+static void
+virtio_disk_io(uint64 sector, void *data, uint len, int write, int *busy)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
   acquire(&disk.vdisk_lock);
 
   // the spec says that legacy block operations use three
@@ -208,12 +219,12 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
+  disk.desc[idx[1]].addr = (uint64) data;
+  disk.desc[idx[1]].len = len;
   if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
+    disk.desc[idx[1]].flags = 0; // device reads data
   else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes data
   disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
   disk.desc[idx[1]].next = idx[2];
 
@@ -223,9 +234,9 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
   disk.desc[idx[2]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  // record the busy flag for virtio_disk_intr().
+  *busy = 1;
+  disk.info[idx[0]].busy = busy;
 
   // avail[0] is flags
   // avail[1] tells the device how far to look in avail[2...].
@@ -238,16 +249,47 @@ virtio_disk_rw(struct buf *b, int write)
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
   // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+  while(*busy == 1) {
+    sleep(busy, &disk.vdisk_lock);
   }
 
-  disk.info[idx[0]].b = 0;
+  disk.info[idx[0]].busy = 0;
   free_chain(idx[0]);
 
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_io(b->blockno * (BSIZE / 512), b->data, BSIZE, write, &b->disk);
+}
+
+// Read or write the page at pa from or to the
+// PGSIZE/BSIZE blocks starting at blockno, bypassing
+// the buffer cache; for swap.c.
+void
+virtio_disk_rwpage(uint blockno, void *pa, int write)
+{
+  int busy;
+
+  virtio_disk_io((uint64)blockno * (BSIZE / 512), pa, PGSIZE, write, &busy);
+}
+
+// Wake up the processes waiting for the operations that
+// virtio_disk_intr() saw finish. Runs on a WQ_INTR worker,
+// which keeps the scan of the process table that wakeup()
+// does out of the interrupt handler.
+static void
+virtio_disk_done(void *arg)
+{
+  acquire(&disk.vdisk_lock);
+  for(int i = 0; i < disk.ndone; i++)
+    wakeup(disk.done[i]);
+  disk.ndone = 0;
+  release(&disk.vdisk_lock);
+}
+
 void
 virtio_disk_intr()
 {
@@ -259,12 +301,14 @@ virtio_disk_intr()
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
     
-    disk.info[id].b->disk = 0;   // disk is done with buf
-    wakeup(disk.info[id].b);
+    *disk.info[id].busy = 0;   // disk is done with the data
+    disk.done[disk.ndone++] = disk.info[id].busy;
 
     disk.used_idx = (disk.used_idx + 1) % NUM;
   }
   *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
 
+  if(disk.ndone > 0)
+    queue_work(WQ_INTR, &disk.donework);
   release(&disk.vdisk_lock);
 }
@@ -3,8 +3,12 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
+#include "sysinfo.h"
 
 /*
  * the kernel's page table.
@@ -24,6 +28,9 @@ kvminit()
   kernel_pagetable = (pagetable_t) kalloc();
   memset(kernel_pagetable, 0, PGSIZE);
 
+  // real-time clock, read once at boot by trapinit().
+  kvmmap(RTC0, RTC0, PGSIZE, PTE_R);
+
   // uart registers
   kvmmap(UART0, UART0, PGSIZE, PTE_R | PTE_W);
 
@@ -31,7 +38,7 @@ kvminit()
   kvmmap(VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
   // CLINT
-  kvmmap(CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+  kvmmap(KCLINT, CLINT, 0x10000, PTE_R | PTE_W);
 
   // PLIC
   kvmmap(PLIC, PLIC, 0x400000, PTE_R | PTE_W);
@@ -56,6 +63,147 @@ kvminithart()
   sfence_vma();
 }
 
+// Switch h/w page table register to satp, which is the
+// kernel's page table or a process's kernel page table.
+// Without ASIDs they can't be told apart in the TLB.
+void
+kvmswitch(uint64 satp)
+{
+  w_satp(satp);
+  if(!hasasids())
+    sfence_vma();
+}
+
+// Create a process's kernel page table: the kernel's, except
+// that user memory below PLIC is mapped at its user addresses
+// (without PTE_U), so copyin() and friends can use them
+// directly; see kvmmirror(). The top-level entries are shared
+// with kernel_pagetable, except the one for the low 1GB, whose
+// level-1 page is private below PLIC.
+// Returns 0 if out of memory.
+pagetable_t
+kvmcreate(void)
+{
+  pagetable_t kpt, l1, kl1;
+
+  if((kpt = (pagetable_t)kalloc()) == 0)
+    return 0;
+  if((l1 = (pagetable_t)kalloc()) == 0){
+    kfree(kpt);
+    return 0;
+  }
+  memmove(kpt, kernel_pagetable, PGSIZE);
+  memset(l1, 0, PGSIZE);
+  kl1 = (pagetable_t)PTE2PA(kernel_pagetable[0]);
+  for(int i = PX(1, PLIC); i < 512; i++)
+    l1[i] = kl1[i];
+  kpt[0] = PA2PTE(l1) | PTE_V;
+  return kpt;
+}
+
+// Free a process's kernel page table, but none of the
+// memory it maps.
+void
+kvmfree(pagetable_t kpt)
+{
+  pagetable_t l1 = (pagetable_t)PTE2PA(kpt[0]);
+
+  for(int i = 0; i < PX(1, PLIC); i++)
+    if((l1[i] & PTE_V) && !PTE_LEAF(l1[i]))
+      kfree((void*)PTE2PA(l1[i]));
+  kfree(l1);
+  kfree(kpt);
+}
+
+// Copy upt's user mappings of [va, end) into the process
+// kernel page table kpt, without PTE_U, and clear kpt's
+// mappings where upt has none. Only addresses below PLIC
+// are mirrored. Returns the number of pages that became
+// mapped, or -1 if out of memory, which leaves the mirror
+// partial; that is allowed, since copyin() falls back to
+// walking upt.
+// Runs with interrupts off, so that swap.c can't take a page
+// between reading its user PTE and mirroring it.
+int
+kvmmirror(pagetable_t kpt, pagetable_t upt, uint64 va, uint64 end)
+{
+  uint64 a, pa, n;
+  pte_t *upte, *kpte;
+  int ulevel, klevel, mapped = 0;
+
+  if(end > PLIC)
+    end = PLIC;
+  push_off();
+  for(a = PGROUNDDOWN(va); a < end; a += n){
+    n = PGSIZE;
+    ulevel = 0;
+    upte = walklevel(upt, a, 0, &ulevel);
+    if(upte == 0 || (*upte & PTE_V) == 0 || (*upte & PTE_U) == 0){
+      kvmunmirror(kpt, a, 1);
+      continue;
+    }
+    if(ulevel == 1 && a % SPGSIZE == 0 && a + SPGSIZE <= end){
+      // mirror the whole superpage with one leaf, unless
+      // there's a level-0 page-table page there already,
+      // which the TLB may have cached.
+      klevel = 1;
+      if((kpte = walklevel(kpt, a, 1, &klevel)) == 0)
+        goto oom;
+      if((*kpte & PTE_V) == 0 || PTE_LEAF(*kpte)){
+        if((*kpte & PTE_V) == 0)
+          mapped += SPGSIZE / PGSIZE;
+        *kpte = *upte & ~PTE_U;
+        n = SPGSIZE;
+        continue;
+      }
+    }
+    klevel = 0;
+    if((kpte = walklevel(kpt, a, 1, &klevel)) == 0)
+      goto oom;
+    if(klevel == 1){
+      // only part of a mirrored superpage is changing.
+      kvmunmirror(kpt, a, 1);
+      if((kpte = walk(kpt, a, 1)) == 0)
+        goto oom;
+    }
+    if((*kpte & PTE_V) == 0)
+      mapped++;
+    pa = PTE2PA(*upte) + (a & (LEAFSIZE(ulevel) - 1));
+    *kpte = PA2PTE(pa) | (PTE_FLAGS(*upte) & ~PTE_U);
+  }
+  pop_off();
+  return mapped;
+
+ oom:
+  pop_off();
+  return -1;
+}
+
+// Remove kpt's mirror of npages of user memory at va.
+// A mirrored superpage that is only partly covered goes
+// entirely, since the mirror need not be complete.
+// Keeps page-table pages, so that flushing the TLB entries
+// for the pages concerned is enough (see proc_tlbinval()).
+void
+kvmunmirror(pagetable_t kpt, uint64 va, uint64 npages)
+{
+  uint64 a, end;
+  pte_t *pte;
+  int level;
+
+  end = va + npages*PGSIZE;
+  if(end > PLIC)
+    end = PLIC;
+  for(a = PGROUNDDOWN(va); a < end; a += PGSIZE){
+    level = 0;
+    if((pte = walklevel(kpt, a, 0, &level)) == 0)
+      continue;
+    *pte = 0;
+    if(level == 1)
+      a = SPGROUNDDOWN(a) + SPGSIZE - PGSIZE;
+  }
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -68,15 +216,34 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// If va lies in a superpage, walk() returns the superpage's
+// level-1 leaf PTE; use walklevel() to find out which it is.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  int level = 0;
+
+  return walklevel(pagetable, va, alloc, &level);
+}
+
+// Like walk(), but stop at the PTE for level *level
+// (0 for a 4096-byte page, 1 for a 2MB superpage), or at
+// a leaf found higher up. Sets *level to the level of the
+// PTE returned.
+pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int *level)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
+  for(int l = 2; l > *level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte)){
+        *level = l;
+        return pte;
+      }
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
       if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
@@ -85,7 +252,7 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(*level, va)];
 }
 
 // Look up a virtual address, return the physical address,
@@ -96,28 +263,30 @@ walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   uint64 pa;
+  int level = 0;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walklevel(pagetable, va, 0, &level);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
+  pa = PTE2PA(*pte) + (PGROUNDDOWN(va) & (LEAFSIZE(level) - 1));
   return pa;
 }
 
-// add a mapping to the kernel page table.
+// add a mapping to the kernel page table,
+// using superpages where alignment allows.
 // only used when booting.
 // does not flush TLB or enable paging.
 void
 kvmmap(uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kernel_pagetable, va, sz, pa, perm) != 0)
+  if(mapsuperpages(kernel_pagetable, va, sz, pa, perm) != 0)
     panic("kvmmap");
 }
 
@@ -128,17 +297,36 @@ kvmmap(uint64 va, uint64 pa, uint64 sz, int perm)
 uint64
 kvmpa(uint64 va)
 {
-  uint64 off = va % PGSIZE;
   pte_t *pte;
   uint64 pa;
+  int level = 0;
   
-  pte = walk(kernel_pagetable, va, 0);
+  pte = walklevel(kernel_pagetable, va, 0, &level);
   if(pte == 0)
     panic("kvmpa");
   if((*pte & PTE_V) == 0)
     panic("kvmpa");
   pa = PTE2PA(*pte);
-  return pa+off;
+  return pa + (va & (LEAFSIZE(level) - 1));
+}
+
+// count the page-table pages in a page table.
+int
+ptpages(pagetable_t pagetable)
+{
+  int n = 1;
+
+  for(int i = 0; i < 512; i++){
+    pte_t pte = pagetable[i];
+    if((pte & PTE_V) && !PTE_LEAF(pte))
+      n += ptpages((pagetable_t)PTE2PA(pte));
+  }
+  return n;
+}
+
+void countKvm(void* ptr) {
+  struct sysinfo* inf = (struct sysinfo*)ptr;
+  inf->nkpt = ptpages(kernel_pagetable);
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
@@ -167,25 +355,131 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   return 0;
 }
 
+// Like mappages(), but map each 2MB-aligned stretch of the
+// range that va and pa share with a single level-1 superpage
+// leaf, and only the unaligned ends with 4096-byte pages.
+// Returns 0 on success, -1 if walk() couldn't allocate a
+// needed page-table page.
+int
+mapsuperpages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
+{
+  uint64 a, last;
+  pte_t *pte;
+  int level;
+
+  a = PGROUNDDOWN(va);
+  last = PGROUNDDOWN(va + size - 1);
+  for(;;){
+    level = 0;
+    if(a % SPGSIZE == 0 && pa % SPGSIZE == 0 && last - a >= SPGSIZE - PGSIZE){
+      level = 1;
+      if((pte = walklevel(pagetable, a, 1, &level)) == 0)
+        return -1;
+      if(level == 1 && (*pte & PTE_V) && !PTE_LEAF(*pte))
+        level = 0; // a page-table page is already there.
+    }
+    if(level == 0 && (pte = walk(pagetable, a, 1)) == 0)
+      return -1;
+    if(*pte & PTE_V)
+      panic("remap");
+    *pte = PA2PTE(pa) | perm | PTE_V;
+    if(last - a < LEAFSIZE(level))
+      break;
+    a += LEAFSIZE(level);
+    pa += LEAFSIZE(level);
+  }
+  return 0;
+}
+
+// Turn the superpage leaf *pte into a pointer to l0, a fresh
+// level-0 page-table page mapping the same memory with the
+// same permissions, 4096 bytes at a time.
+static void
+splitleaf(pte_t *pte, pagetable_t l0)
+{
+  uint64 pa = PTE2PA(*pte);
+  uint64 flags = PTE_FLAGS(*pte);
+
+  for(int i = 0; i < 512; i++)
+    l0[i] = PA2PTE(pa + i*PGSIZE) | flags;
+  *pte = PA2PTE(l0) | PTE_V;
+}
+
+// If va is mapped by a superpage, split it into 4096-byte
+// pages. Returns 0 on success, -1 if out of memory.
+int
+uvmsplit(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  pagetable_t l0;
+  int level = 0;
+
+  pte = walklevel(pagetable, va, 0, &level);
+  if(pte == 0 || level == 0 || (*pte & PTE_V) == 0)
+    return 0;
+  if((l0 = (pagetable_t)kalloc()) == 0)
+    return -1;
+  splitleaf(pte, l0);
+  return 0;
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
-// Optionally free the physical memory.
+// page-aligned. Pages that were never faulted in (see
+// vmfault()) are skipped. Optionally free the physical memory.
+// A superpage that is only partly unmapped is split first.
+// Doesn't flush the TLB, since a page table doesn't know which
+// procs run on it: a caller whose page table may run again
+// must call proc_tlbinval() once it drops the memlock.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, end;
   pte_t *pte;
+  int level;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+  end = va + npages*PGSIZE;
+  for(a = va; a < end; a += PGSIZE){
+    preempt();
+    level = 0;
+    if((pte = walklevel(pagetable, a, 0, &level)) == 0)
+      continue;
+    if(PTE_SWAPPED(*pte)){
+      if(do_free)
+        swapfree(*pte);
+      *pte = 0;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
+    if(level == 1 && a % SPGSIZE == 0 && a + SPGSIZE <= end){
+      // the whole superpage goes.
+      if(do_free)
+        ksuperfree((void*)PTE2PA(*pte));
+      *pte = 0;
+      a += SPGSIZE - PGSIZE;
+      continue;
+    }
+    if(level == 1){
+      // only part of the superpage goes. if the page at a is
+      // to be freed anyway, it can serve as the new level-0
+      // page-table page; otherwise allocate one.
+      pagetable_t l0;
+      if(do_free)
+        l0 = (pagetable_t)(PTE2PA(*pte) + (a - SPGROUNDDOWN(a)));
+      else if((l0 = (pagetable_t)kalloc()) == 0)
+        panic("uvmunmap: split");
+      splitleaf(pte, l0);
+      pte = &l0[PX(0, a)];
+      if(do_free){
+        *pte = 0;
+        continue;
+      }
+    }
     if(do_free){
       uint64 pa = PTE2PA(*pte);
       kfree((void*)pa);
@@ -225,25 +519,35 @@ uvminit(pagetable_t pagetable, uchar *src, uint sz)
 
 // Allocate PTEs and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
+// Each 2MB-aligned stretch of the new memory gets a superpage,
+// if a free one is available.
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
   char *mem;
-  uint64 a;
+  uint64 a, n;
 
   if(newsz < oldsz)
     return oldsz;
 
   oldsz = PGROUNDUP(oldsz);
-  for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+  for(a = oldsz; a < newsz; a += n){
+    n = PGSIZE;
+    mem = 0;
+    if(a % SPGSIZE == 0 && a + SPGSIZE <= newsz && (mem = ksuperalloc()) != 0)
+      n = SPGSIZE;
+    else
+      mem = kalloc();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
-    if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
-      kfree(mem);
+    memset(mem, 0, n);
+    if(mapsuperpages(pagetable, a, n, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+      if(n == SPGSIZE)
+        ksuperfree(mem);
+      else
+        kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
@@ -277,6 +581,7 @@ freewalk(pagetable_t pagetable)
   // there are 2^9 = 512 PTEs in a page table.
   for(int i = 0; i < 512; i++){
     pte_t pte = pagetable[i];
+    preempt();
     if((pte & PTE_V) && (pte & (PTE_R|PTE_W|PTE_X)) == 0){
       // this PTE points to a lower-level page table.
       uint64 child = PTE2PA(pte);
@@ -305,26 +610,57 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 // physical memory.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
+//
+// A superpage is copied into a superpage if a free one is
+// available, and into 4096-byte pages otherwise. Pages the
+// parent hasn't faulted in yet are left for the child to.
+// Read-only pages, such as program text, are shared, and
+// so are the swap slots of pages that are swapped out.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
-  uint64 pa, i;
+  pte_t *pte, *npte;
+  uint64 pa, i, n;
   uint flags;
   char *mem;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+  int level;
+
+  for(i = 0; i < sz; i += n){
+    preempt();
+    n = PGSIZE;
+    level = 0;
+    if((pte = walklevel(old, i, 0, &level)) == 0)
+      continue;
+    if(PTE_SWAPPED(*pte)){
+      if((npte = walk(new, i, 1)) == 0)
+        goto err;
+      swapdup(*pte);
+      *npte = *pte;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
-    pa = PTE2PA(*pte);
+      continue;
+    pa = PTE2PA(*pte) + (i & (LEAFSIZE(level) - 1));
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if(level == 0 && (flags & PTE_W) == 0){
+      kdup((void*)pa);
+      if(mappages(new, i, PGSIZE, pa, flags) != 0){
+        kfree((void*)pa);
+        goto err;
+      }
+      continue;
+    }
+    mem = 0;
+    if(level == 1 && i % SPGSIZE == 0 && (mem = ksuperalloc()) != 0)
+      n = SPGSIZE;
+    else if((mem = kalloc()) == 0)
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
+    memmove(mem, (char*)pa, n);
+    if(mapsuperpages(new, i, n, (uint64)mem, flags) != 0){
+      if(n == SPGSIZE)
+        ksuperfree(mem);
+      else
+        kfree(mem);
       goto err;
     }
   }
@@ -342,29 +678,187 @@ uvmclear(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   
+  if(uvmsplit(pagetable, va) < 0)
+    panic("uvmclear: split");
   pte = walk(pagetable, va, 0);
   if(pte == 0)
     panic("uvmclear");
   *pte &= ~PTE_U;
 }
 
+// count the superpages mapped in a page table.
+int
+uvmsupercount(pagetable_t pagetable)
+{
+  int n = 0;
+
+  for(int i = 0; i < 512; i++){
+    pte_t pte = pagetable[i];
+    if((pte & PTE_V) == 0 || PTE_LEAF(pte))
+      continue;
+    pagetable_t l1 = (pagetable_t)PTE2PA(pte);
+    for(int j = 0; j < 512; j++)
+      if((l1[j] & PTE_V) && PTE_LEAF(l1[j]))
+        n++;
+  }
+  return n;
+}
+
+// A store to a page that ksm.c merged with others: give p a
+// copy of its own, unless no one else has it any more.
+// p's other threads are stopped meanwhile, since the page
+// goes from under them.
+static int
+cowfault(struct proc *p, uint64 va, pte_t *pte)
+{
+  pte_t old;
+  char *pa, *mem;
+
+  mmstop(p);
+  old = *pte;
+  pa = (char*)PTE2PA(old);
+  if((old & (PTE_V|PTE_COW)) != (PTE_V|PTE_COW)){
+    // another thread got here first.
+    mmstart(p);
+    return 0;
+  }
+  if(krefs(pa) == 1){
+    *pte = (old & ~PTE_COW) | PTE_W | PTE_A | PTE_D;
+    proc_tlbinval(p, va, 1);
+    mmstart(p);
+    return 0;
+  }
+  if((mem = ukalloc()) == 0){
+    mmstart(p);
+    return -1;
+  }
+  if(*pte != old){
+    // changed while ukalloc() slept; just retry.
+    mmstart(p);
+    kfree(mem);
+    return 0;
+  }
+  memmove(mem, pa, PGSIZE);
+  *pte = PA2PTE(mem) | (PTE_FLAGS(old) & ~PTE_COW) | PTE_W | PTE_A | PTE_D;
+  proc_tlbinval(p, va, 1);
+  mmstart(p);
+  kfree(pa);
+  return 0;
+}
+
+// Handle a fault on user address va in process p, by reading
+// in the page from p's program (see segpage()) or from swap,
+// or zero-filling it. Returns 0 if the access can be retried,
+// -1 if it's a real fault. May sleep.
+// p's other threads may be faulting on the same page, so a
+// page is only mapped if the PTE is still empty, under the
+// group's memlock.
+int
+vmfault(struct proc *p, uint64 va, int write)
+{
+  struct proc *g = p->group;
+  pte_t *pte;
+  uint64 pa;
+  int perm, r;
+
+  if(va >= g->sz)
+    return vmafault(p, va, write);
+  va = PGROUNDDOWN(va);
+  pte = walk(p->pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    if(write && (*pte & (PTE_U|PTE_COW)) == (PTE_U|PTE_COW))
+      return cowfault(p, va, pte);
+    // a guard page, or the TLB was stale, or the hardware
+    // leaves setting PTE_A and PTE_D to software.
+    if((*pte & PTE_U) == 0 || (write && (*pte & PTE_W) == 0))
+      return -1;
+    __sync_fetch_and_or(pte, PTE_A | (write ? PTE_D : 0));
+    sfence_vma_page(va, hasasids() ? p->asid : 0);
+    return 0;
+  }
+  if(pte && PTE_SWAPPED(*pte)){
+    if(write && (*pte & PTE_W) == 0)
+      return -1;
+    acquiresleep(&g->mmlock);
+    r = PTE_SWAPPED(*pte) ? swapin(p, va, pte) : 0;
+    releasesleep(&g->mmlock);
+    if(r < 0)
+      return -1;
+    kvmmirror(p->kpagetable, p->pagetable, va, va + PGSIZE);
+    return 0;
+  }
+
+  if((pa = segpage(p, va, &perm)) == 0)
+    return -1;
+  acquire(&g->memlock);
+  pte = walk(p->pagetable, va, 0);
+  if(va >= g->sz || (pte && (*pte & (PTE_V|PTE_SWAP)))){
+    // shrunk, or faulted in by another thread, meanwhile.
+    release(&g->memlock);
+    kfree((void*)pa);
+    return 0;
+  }
+  if(mappages(p->pagetable, va, PGSIZE, pa, perm) != 0){
+    release(&g->memlock);
+    kfree((void*)pa);
+    return -1;
+  }
+  release(&g->memlock);
+  kvmmirror(p->kpagetable, p->pagetable, va, va + PGSIZE);
+  return 0;
+}
+
+// Like walkaddr(), but fail if write and the page isn't
+// writable, and if the page belongs to the current process
+// and hasn't been faulted in, do that, unless holding a
+// spinlock, since vmfault() may sleep.
+// Returns with interrupts off if it succeeds, so that the
+// page can't be swapped out before the caller is done with
+// it; the caller must then pop_off().
+uint64
+uvmaddr(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  uint64 pa;
+  int locked;
+
+  for(;;){
+    push_off();
+    pa = walkaddr(pagetable, va);
+    if(pa != 0 && (!write || (*walk(pagetable, va, 0) & PTE_W)))
+      return pa;
+    locked = mycpu()->noff > 1;
+    pop_off();
+    if(p == 0 || pagetable != p->pagetable)
+      return 0;
+    if(locked || vmfault(p, va, write) < 0)
+      return 0;
+  }
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
+// Tries the current process's kernel mirror first (vmcopyin.c),
+// and falls back to walking pagetable.
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(copyout_new(pagetable, dstva, src, len) == 0)
+    return 0;
+
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 1);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
     memmove((void *)(pa0 + (dstva - va0)), src, n);
+    pop_off();
 
     len -= n;
     src += n;
@@ -381,15 +875,19 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(copyin_new(pagetable, dst, srcva, len) == 0)
+    return 0;
+
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
       n = len;
     memmove(dst, (void *)(pa0 + (srcva - va0)), n);
+    pop_off();
 
     len -= n;
     dst += n;
@@ -408,9 +906,12 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   uint64 n, va0, pa0;
   int got_null = 0;
 
+  if(copyinstr_new(pagetable, dst, srcva, max) == 0)
+    return 0;
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -431,6 +932,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
       p++;
       dst++;
     }
+    pop_off();
 
     srcva = va0 + PGSIZE;
   }
@@ -0,0 +1,416 @@
+//
+// mmap() regions.
+//
+// each process has up to NVMA of them, allocated downward
+// from MMAPTOP, above the heap. their pages are filled in on
+// first touch by vmafault(), which vmfault() calls for
+// addresses above p->sz.
+//
+// threads share their group's regions, which change under
+// the group's mmlock, and its memlock for the sake of
+// vmafault(), which doesn't take mmlock.
+//
+// a MAP_SHARED file page is first mapped without PTE_W, even
+// if the region is writable, so that the first store faults
+// and vmafault() can note it by adding PTE_W. when the region
+// goes, by munmap(), exit() or exec(), the pages with PTE_W
+// are written back to the file through writei(). fork()
+// gives the child the same physical pages of a MAP_SHARED
+// region, and copies of MAP_PRIVATE ones.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "defs.h"
+
+static struct vma*
+vmafind(struct proc *g, uint64 va)
+{
+  struct vma *v;
+
+  for(v = g->vma; v < &g->vma[NVMA]; v++)
+    if(v->len && v->addr <= va && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+// Make a region of len bytes for mmap(); see sys_mmap().
+// Takes a new reference to f, if any.
+// Returns its address, or 0 if there's no room.
+uint64
+vmaalloc(struct proc *p, uint64 len, int prot, int flags, struct file *f, uint64 off)
+{
+  struct proc *g = p->group;
+  struct vma *v, *free = 0;
+  uint64 a, lo;
+  int i;
+
+  if(len == 0 || len > MMAPTOP || off % PGSIZE || p->vfparent)
+    return 0;
+  len = PGROUNDUP(len);
+  acquiresleep(&g->mmlock);
+  for(v = g->vma; v < &g->vma[NVMA]; v++)
+    if(v->len == 0 && free == 0)
+      free = v;
+  if(free == 0)
+    goto bad;
+
+  // take the highest gap that is big enough.
+  lo = PGROUNDUP(g->sz);
+  if(len > MMAPTOP - lo)
+    goto bad;
+  a = MMAPTOP - len;
+  for(i = 0; i < NVMA; i++){
+    v = &g->vma[i];
+    if(v->len && v->addr < a + len && a < v->addr + v->len){
+      if(v->addr - lo < len)
+        goto bad;
+      a = v->addr - len;
+      i = -1;   // start over
+    }
+  }
+
+  acquire(&g->memlock);
+  free->addr = a;
+  free->len = len;
+  free->prot = prot;
+  free->flags = flags;
+  free->f = f ? filedup(f) : 0;
+  free->off = off;
+  release(&g->memlock);
+  releasesleep(&g->mmlock);
+  return a;
+
+ bad:
+  releasesleep(&g->mmlock);
+  return 0;
+}
+
+// Write the pages of [va, end) of v that have been written
+// to back to v's file, a few blocks per log transaction,
+// as filewrite() does. Doesn't extend the file.
+static void
+vmawriteback(struct proc *p, struct vma *v, uint64 va, uint64 end)
+{
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  struct inode *ip;
+  uint64 a, off, pa;
+  pte_t *pte;
+  int i, n;
+
+  if(v->f == 0 || (v->flags & MAP_SHARED) == 0 || (v->prot & PROT_WRITE) == 0)
+    return;
+  ip = v->f->ip;
+  for(a = va; a < end; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_W) == 0)
+      continue;
+    pa = PTE2PA(*pte);
+    off = v->off + (a - v->addr);
+    for(i = 0; i < PGSIZE; i += n){
+      begin_op();
+      ilock(ip);
+      n = 0;
+      if(off + i < ip->size){
+        n = PGSIZE - i;
+        if(n > max)
+          n = max;
+        if(n > ip->size - (off + i))
+          n = ip->size - (off + i);
+        if(writei(ip, 0, pa + i, off + i, n) != n)
+          n = 0;
+      }
+      iunlock(ip);
+      end_op();
+      if(n == 0)
+        break;
+    }
+  }
+}
+
+// Unmap [va, va+len) from whatever regions it overlaps,
+// writing back MAP_SHARED pages first. A region may lose
+// its start, its end, or a piece from the middle, which
+// takes a free slot for the piece after the hole.
+// Returns 0, or -1 if a region can't be split.
+int
+vmaunmap(struct proc *p, uint64 va, uint64 len)
+{
+  struct proc *g = p->group;
+  struct vma *v, *w, old[NVMA];
+  struct file *closing[2*NVMA];
+  uint64 end, lo, hi, vend;
+  int i, splits = 0, free = 0, nclose = 0, r = -1;
+
+  if(va % PGSIZE || len == 0 || len > MMAPTOP || va > MMAPTOP - len ||
+     p->vfparent)
+    return -1;
+  end = va + PGROUNDUP(len);
+
+  // write back before stopping the other threads, since
+  // writing sleeps for locks they may hold. the copy holds
+  // its own references to the files.
+  acquire(&g->memlock);
+  memmove(old, g->vma, sizeof(old));
+  for(v = old; v < &old[NVMA]; v++)
+    if(v->len && v->f)
+      filedup(v->f);
+  release(&g->memlock);
+  for(v = old; v < &old[NVMA]; v++){
+    vend = v->addr + v->len;
+    if(v->len && va < vend && v->addr < end)
+      vmawriteback(p, v, va > v->addr ? va : v->addr, end < vend ? end : vend);
+    if(v->len && v->f)
+      closing[nclose++] = v->f;
+  }
+
+  mmstop(p);
+  for(v = g->vma; v < &g->vma[NVMA]; v++){
+    if(v->len == 0)
+      free++;
+    else if(v->addr < va && end < v->addr + v->len)
+      splits++;
+  }
+  if(splits > free)
+    goto out;
+
+  for(v = g->vma; v < &g->vma[NVMA]; v++){
+    vend = v->addr + v->len;
+    if(v->len == 0 || vend <= va || end <= v->addr)
+      continue;
+    lo = va > v->addr ? va : v->addr;
+    hi = end < vend ? end : vend;
+    acquire(&g->memlock);
+    uvmunmap(p->pagetable, lo, (hi - lo) / PGSIZE, 1);
+    if(lo == v->addr && hi == vend){
+      if(v->f)
+        closing[nclose++] = v->f;
+      memset(v, 0, sizeof(*v));
+    } else if(lo == v->addr){
+      v->off += hi - v->addr;
+      v->addr = hi;
+      v->len = vend - hi;
+    } else if(hi == vend){
+      v->len = lo - v->addr;
+    } else {
+      for(w = g->vma; w->len; w++)
+        ;
+      *w = *v;
+      w->addr = hi;
+      w->len = vend - hi;
+      w->off = v->off + (hi - v->addr);
+      if(w->f)
+        filedup(w->f);
+      v->len = lo - v->addr;
+    }
+    release(&g->memlock);
+    proc_tlbinval(p, lo, (hi - lo) / PGSIZE);
+  }
+  r = 0;
+
+ out:
+  mmstart(p);
+  for(i = 0; i < nclose; i++)
+    fileclose(closing[i]);
+  return r;
+}
+
+// Unmap all of p's regions, for exit() and exec().
+void
+vmaclear(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->group->vma; v < &p->group->vma[NVMA]; v++)
+    if(v->len)
+      vmaunmap(p, v->addr, v->len);
+}
+
+// The lowest address of any region, which the heap must
+// stay below.
+uint64
+vmabase(struct proc *p)
+{
+  struct proc *g = p->group;
+  struct vma *v;
+  uint64 base = MMAPTOP;
+
+  for(v = g->vma; v < &g->vma[NVMA]; v++)
+    if(v->len && v->addr < base)
+      base = v->addr;
+  return base;
+}
+
+// Handle a page fault at va, above p->sz, on behalf of p.
+// Returns 0 if the access should be retried, -1 if it's
+// not allowed.
+int
+vmafault(struct proc *p, uint64 va, int write)
+{
+  struct proc *g = p->group;
+  struct vma v, *w;
+  struct inode *ip;
+  pte_t *pte;
+  char *mem;
+  uint64 off;
+  int perm, locked = 0;
+
+  // work from a copy, since another thread may unmap the
+  // region while this one sleeps.
+  acquire(&g->memlock);
+  if((w = vmafind(g, va)) == 0){
+    release(&g->memlock);
+    return -1;
+  }
+  v = *w;
+  release(&g->memlock);
+  if(v.prot == PROT_NONE || (write && (v.prot & PROT_WRITE) == 0))
+    return -1;
+  va = PGROUNDDOWN(va);
+
+  pte = walk(p->pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    if(write && (*pte & PTE_W) == 0){
+      // first store to a MAP_SHARED file page.
+      __sync_fetch_and_or(pte, PTE_W);
+      proc_tlbinval(p, va, 1);
+      return 0;
+    }
+    // the TLB was stale.
+    sfence_vma_page(va, hasasids() ? p->asid : 0);
+    return 0;
+  }
+
+  perm = PTE_U | PTE_R;
+  if(v.prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(v.prot & PROT_EXEC)
+    perm |= PTE_X;
+  if(v.f && (v.flags & MAP_SHARED) && !write)
+    perm &= ~PTE_W;
+
+  if((mem = ukalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(v.f){
+    // a read() or write() of the mapped file into the mapping
+    // may be what faulted, in which case we hold ip's lock.
+    ip = v.f->ip;
+    if(!holdingsleep(&ip->lock)){
+      ilock(ip);
+      locked = 1;
+    }
+    off = v.off + (va - v.addr);
+    if(readi(ip, 0, (uint64)mem, off, PGSIZE) < 0){
+      if(locked)
+        iunlock(ip);
+      kfree(mem);
+      return -1;
+    }
+    if(locked)
+      iunlock(ip);
+  }
+  acquire(&g->memlock);
+  pte = walk(p->pagetable, va, 0);
+  if((w = vmafind(g, va)) == 0 || memcmp(w, &v, sizeof(v)) != 0 ||
+     (pte && (*pte & PTE_V))){
+    // unmapped, or faulted in by another thread, meanwhile.
+    release(&g->memlock);
+    kfree(mem);
+    return 0;
+  }
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    release(&g->memlock);
+    kfree(mem);
+    return -1;
+  }
+  release(&g->memlock);
+  kvmmirror(p->kpagetable, p->pagetable, va, va + PGSIZE);
+  return 0;
+}
+
+// Fault in every page of p's MAP_SHARED regions, so that
+// fork() can share them with the child. fork() must call
+// this before it takes the child's lock, since it sleeps.
+int
+vmapopulate(struct proc *p)
+{
+  struct proc *g = p->group;
+  struct vma *v;
+  uint64 a;
+  pte_t *pte;
+
+  for(v = g->vma; v < &g->vma[NVMA]; v++){
+    if(v->len == 0 || (v->flags & MAP_SHARED) == 0 || v->prot == PROT_NONE)
+      continue;
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      pte = walk(p->pagetable, a, 0);
+      if(pte && (*pte & PTE_V))
+        continue;
+      if(vmafault(p, a, 0) < 0)
+        return -1;
+    }
+  }
+  return 0;
+}
+
+// Give np copies of p's regions: the same pages for
+// MAP_SHARED ones and for read-only pages, copies of the
+// rest. Returns 0 on success, -1 on failure, having freed
+// what it copied.
+int
+vmacopy(struct proc *p, struct proc *np)
+{
+  struct proc *g = p->group;
+  struct vma *v;
+  uint64 a, pa;
+  pte_t *pte;
+  char *mem;
+  int flags;
+
+  for(v = g->vma; v < &g->vma[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      preempt();
+      pte = walk(p->pagetable, a, 0);
+      if(pte == 0 || (*pte & PTE_V) == 0)
+        continue;
+      pa = PTE2PA(*pte);
+      flags = PTE_FLAGS(*pte);
+      if((v->flags & MAP_SHARED) || (flags & PTE_W) == 0){
+        kdup((void*)pa);
+        mem = (char*)pa;
+      } else {
+        if((mem = kalloc()) == 0)
+          goto err;
+        memmove(mem, (char*)pa, PGSIZE);
+      }
+      if(mappages(np->pagetable, a, PGSIZE, (uint64)mem, flags) != 0){
+        kfree(mem);
+        goto err;
+      }
+    }
+  }
+
+  for(v = g->vma; v < &g->vma[NVMA]; v++){
+    np->vma[v - g->vma] = *v;
+    if(v->len && v->f)
+      filedup(v->f);
+  }
+  return 0;
+
+ err:
+  for(v = g->vma; v < &g->vma[NVMA]; v++)
+    if(v->len)
+      uvmunmap(np->pagetable, v->addr, v->len / PGSIZE, 1);
+  return -1;
+}
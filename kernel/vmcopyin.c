@@ -0,0 +1,94 @@
+//
+// copy to and from user memory through the current process's
+// kernel page table, which maps user memory below PLIC at the
+// user's addresses (see kvmcreate() and kvmmirror() in vm.c),
+// so that copyin() and friends are a memmove() rather than a
+// page-table walk per page.
+//
+// the mirror may lack pages the user page table has, and the
+// user may hand us bad addresses, so a page fault during one
+// of these copies doesn't panic: the copies are done by the
+// loops in ucopy.S, and kerneltrap() calls uaccessfault() for
+// a fault in them, which mirrors the page if it can, and
+// otherwise resumes at ucopyfault, which makes the copy return
+// -1. vm.c then falls back to walking the user page table,
+// which has the final word.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+
+extern char ucopystart[], ucopyend[], ucopyfault[];   // ucopy.S
+
+// Return the current process if [va, va+len) of pagetable
+// can be reached through its kernel page table, else 0.
+static struct proc*
+mirrored(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || p->kpagetable == 0 || pagetable != p->pagetable)
+    return 0;
+  if(va >= PLIC || len > PLIC - va)
+    return 0;
+  return p;
+}
+
+// Copy from kernel to user.
+// Returns 0 on success, -1 if the caller should copy the slow way.
+int
+copyout_new(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
+{
+  if(mirrored(pagetable, dstva, len) == 0)
+    return -1;
+  return ucopy((void *)dstva, src, len);
+}
+
+// Copy from user to kernel.
+// Returns 0 on success, -1 if the caller should copy the slow way.
+int
+copyin_new(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
+{
+  if(mirrored(pagetable, srcva, len) == 0)
+    return -1;
+  return ucopy(dst, (void *)srcva, len);
+}
+
+// Copy a null-terminated string from user to kernel, until a
+// '\0' or max bytes. Returns 0 on success, -1 if the caller
+// should copy the slow way.
+int
+copyinstr_new(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
+{
+  uint64 n;
+
+  if(mirrored(pagetable, srcva, 0) == 0)
+    return -1;
+  n = max < PLIC - srcva ? max : PLIC - srcva;
+  return ucopystr(dst, (char *)srcva, n);
+}
+
+// kerneltrap() calls this for a kernel page fault at sepc.
+// Returns 0 if it wasn't in ucopy.S, else where to resume:
+// sepc, to retry, if the page is now mirrored, or else
+// ucopyfault, to fail the copy.
+uint64
+uaccessfault(uint64 sepc)
+{
+  struct proc *p = myproc();
+  uint64 va = r_stval();
+
+  if(sepc < (uint64)ucopystart || sepc >= (uint64)ucopyend)
+    return 0;
+  if(p && va < PLIC && kvmmirror(p->kpagetable, p->pagetable, va, va + 1) > 0){
+    sfence_vma_page(PGROUNDDOWN(va), SATP2ASID(r_satp()));
+    return sepc;
+  }
+  return (uint64)ucopyfault;
+}
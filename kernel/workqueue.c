@@ -0,0 +1,112 @@
+//
+// deferred work.
+//
+// an interrupt handler, or code that doesn't want to wait,
+// can hand a work item to queue_work(), and a kernel thread
+// calls its function later, in process context, where it may
+// take sleep locks and sleep. each hart has its own queues,
+// and a worker thread, kworker, for each, which runs only on
+// that hart, so that queueing only takes the queueing hart's
+// lock, and the work stays where it was queued.
+//
+// an item on the WQ_INTR queues must not sleep, since the
+// items that finish disk I/O, and so wake up whoever is
+// waiting for it, are among them. items that sleep go on the
+// WQ_NORMAL queues.
+//
+// an item is queued at most once at a time; queueing it
+// again before its function starts does nothing.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "workqueue.h"
+#include "defs.h"
+
+struct workqueue {
+  struct spinlock lock;
+  struct work *head;
+  struct work *tail;
+};
+
+static struct workqueue wq[NCPU][NWQ];
+
+static void kworker(void*);
+
+// Called once, by hart 0, before any interrupts.
+void
+workqueueinit(void)
+{
+  for(int c = 0; c < NCPU; c++)
+    for(int q = 0; q < NWQ; q++)
+      initlock(&wq[c][q].lock, "workqueue");
+}
+
+// Start this hart's workers, which run only on this hart.
+void
+workqueueinithart(void)
+{
+  static char *names[NWQ] = { "kworker/i", "kworker" };
+  struct workqueue *q;
+  int c = cpuid();
+
+  for(q = wq[c]; q < &wq[c][NWQ]; q++)
+    if(kthread_create_on_cpu(kworker, q, names[q - wq[c]], c) == 0)
+      panic("workqueueinithart");
+}
+
+void
+initwork(struct work *w, void (*fn)(void*), void *arg)
+{
+  w->fn = fn;
+  w->arg = arg;
+  w->next = 0;
+  w->pending = 0;
+}
+
+// Have a worker call w->fn(w->arg) soon, unless w is already
+// queued. Which is WQ_INTR or WQ_NORMAL.
+// May be called from an interrupt handler.
+void
+queue_work(int which, struct work *w)
+{
+  struct workqueue *q;
+
+  if(__sync_lock_test_and_set(&w->pending, 1))
+    return;
+  push_off();
+  q = &wq[cpuid()][which];
+  acquire(&q->lock);
+  w->next = 0;
+  if(q->head == 0)
+    q->head = w;
+  else
+    q->tail->next = w;
+  q->tail = w;
+  wakeup(q);
+  release(&q->lock);
+  pop_off();
+}
+
+static void
+kworker(void *arg)
+{
+  struct workqueue *q = arg;
+  struct work *w;
+
+  for(;;){
+    acquire(&q->lock);
+    while(q->head == 0)
+      sleep(q, &q->lock);
+    w = q->head;
+    q->head = w->next;
+    release(&q->lock);
+    __sync_lock_release(&w->pending);
+    w->fn(w->arg);
+  }
+}
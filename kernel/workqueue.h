@@ -0,0 +1,11 @@
+// Deferred work; see workqueue.c.
+struct work {
+  void (*fn)(void*);   // what to do
+  void *arg;
+  struct work *next;   // on its queue
+  int pending;         // queued, and fn hasn't started yet
+};
+
+#define WQ_INTR   0    // for interrupt handlers; items must not sleep
+#define WQ_NORMAL 1    // items may sleep, but not wait for each other
+#define NWQ       2
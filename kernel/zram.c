@@ -0,0 +1,295 @@
+//
+// compressed in-memory store for swapped-out pages.
+//
+// swapvictim() offers each page it takes to zstore() before
+// giving it a slot on disk. zstore() compresses the page with
+// a small LZ77 codec in the style of LZ4 and keeps the result
+// in a slab of same-sized objects; swapin() gets it back with
+// zload(). a page that compresses to more than ZMAXLEN bytes
+// isn't worth keeping, and goes to disk instead.
+//
+// a slab is a page, with a header in its first ZUNIT bytes.
+// zstore() runs when memory is short, so when a size class
+// needs a new slab, the page being stored becomes it.
+// a slab is freed when its last object is.
+//
+// a handle is an object's address, in ZUNITs from KERNBASE.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "sysinfo.h"
+#include "defs.h"
+
+#define ZUNIT    64                    // object sizes are multiples of this
+#define ZMAXLEN  (PGSIZE * 3 / 4)      // largest compressed page kept
+#define NZCLASS  ((sizeof(struct zobj) + ZMAXLEN + ZUNIT - 1) / ZUNIT + 1)
+#define MINMATCH 4
+#define HASHBITS 10
+
+// a stored page: this header, then the compressed bytes.
+struct zobj {
+  ushort len;           // compressed bytes
+  ushort ref;           // PTEs naming it; see swapdup()
+};
+
+// the header of a slab.
+struct zslab {
+  struct zslab *next;   // partly free slabs of the same size
+  uint64 used;          // bit per object
+  ushort size;          // object size
+  ushort nobj;          // objects in the slab
+  ushort nused;
+};
+
+struct {
+  struct spinlock lock;
+  struct zslab *partial[NZCLASS];  // by size / ZUNIT
+  uint64 nstored;       // pages stored
+  uint64 nbytes;        // compressed bytes stored
+  uint64 nslabs;        // pages of slabs
+  ushort hash[1 << HASHBITS];      // compressor's match finder
+  uchar buf[PGSIZE];    // compressor output
+} zram;
+
+void
+zraminit(void)
+{
+  initlock(&zram.lock, "zram");
+}
+
+static uint32
+load32(uchar *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32)p[3] << 24);
+}
+
+// Append a length nibble's overflow: runs of 255, then the rest.
+static int
+lzlen(uchar *dst, int op, int max, int n)
+{
+  for(; n >= 255; n -= 255){
+    if(op >= max)
+      return -1;
+    dst[op++] = 255;
+  }
+  if(op >= max)
+    return -1;
+  dst[op++] = n;
+  return op;
+}
+
+// Append a sequence: nlit literal bytes from lit, then a match
+// of mlen bytes off bytes back, unless mlen is 0, which ends
+// the page. Returns the new output length, or -1 if it would
+// pass max.
+static int
+lzemit(uchar *dst, int op, int max, uchar *lit, int nlit, int off, int mlen)
+{
+  int m = mlen ? mlen - MINMATCH : 0;
+
+  if(op >= max)
+    return -1;
+  dst[op++] = ((nlit < 15 ? nlit : 15) << 4) | (m < 15 ? m : 15);
+  if(nlit >= 15 && (op = lzlen(dst, op, max, nlit - 15)) < 0)
+    return -1;
+  if(op + nlit > max)
+    return -1;
+  memmove(dst + op, lit, nlit);
+  op += nlit;
+  if(mlen == 0)
+    return op;
+  if(op + 2 > max)
+    return -1;
+  dst[op++] = off;
+  dst[op++] = off >> 8;
+  if(m >= 15 && (op = lzlen(dst, op, max, m - 15)) < 0)
+    return -1;
+  return op;
+}
+
+// Compress a page from src into dst. Returns the compressed
+// length, or -1 if it's more than max.
+// Caller must hold zram.lock, for zram.hash.
+static int
+lzcompress(uchar *src, uchar *dst, int max)
+{
+  int ip = 0, anchor = 0, op = 0, ref, len;
+  uint32 seq, h;
+
+  memset(zram.hash, 0, sizeof(zram.hash));
+  while(ip + MINMATCH <= PGSIZE){
+    seq = load32(src + ip);
+    h = (seq * 2654435761U) >> (32 - HASHBITS);
+    ref = zram.hash[h] - 1;
+    zram.hash[h] = ip + 1;
+    if(ref < 0 || load32(src + ref) != seq){
+      ip++;
+      continue;
+    }
+    for(len = MINMATCH; ip + len < PGSIZE && src[ref + len] == src[ip + len]; len++)
+      ;
+    op = lzemit(dst, op, max, src + anchor, ip - anchor, ip - ref, len);
+    if(op < 0)
+      return -1;
+    ip += len;
+    anchor = ip;
+  }
+  if(anchor < PGSIZE)
+    op = lzemit(dst, op, max, src + anchor, PGSIZE - anchor, 0, 0);
+  return op;
+}
+
+// Decompress n bytes from src into the page dst.
+static void
+lzdecompress(uchar *src, int n, uchar *dst)
+{
+  int ip = 0, op = 0, nlit, mlen, off;
+  uchar b;
+
+  while(op < PGSIZE){
+    if(ip >= n)
+      panic("lzdecompress");
+    b = src[ip++];
+    nlit = b >> 4;
+    if(nlit == 15)
+      do nlit += src[ip]; while(src[ip++] == 255);
+    if(nlit > PGSIZE - op || ip + nlit > n)
+      panic("lzdecompress: literals");
+    memmove(dst + op, src + ip, nlit);
+    ip += nlit;
+    op += nlit;
+    if(op == PGSIZE)
+      break;
+    off = src[ip] | (src[ip+1] << 8);
+    ip += 2;
+    mlen = (b & 15) + MINMATCH;
+    if((b & 15) == 15)
+      do mlen += src[ip]; while(src[ip++] == 255);
+    if(off == 0 || off > op || mlen > PGSIZE - op)
+      panic("lzdecompress: match");
+    // byte at a time, since a match may overlap itself.
+    for(; mlen > 0; mlen--, op++)
+      dst[op] = dst[op - off];
+  }
+}
+
+static struct zobj*
+zobj(int h)
+{
+  return (struct zobj*)(KERNBASE + (uint64)h * ZUNIT);
+}
+
+// Store a compressed copy of the page at pa, if it
+// compresses well enough. Returns a handle for zload(), or -1.
+// Sets *kept if the page has become a slab to hold it, rather
+// than being free for the caller to kfree().
+int
+zstore(void *pa, int *kept)
+{
+  struct zslab *s;
+  struct zobj *o;
+  int n, size, i;
+
+  *kept = 0;
+  acquire(&zram.lock);
+  if((n = lzcompress(pa, zram.buf, ZMAXLEN)) < 0){
+    release(&zram.lock);
+    return -1;
+  }
+  size = (sizeof(struct zobj) + n + ZUNIT - 1) / ZUNIT * ZUNIT;
+  if((s = zram.partial[size / ZUNIT]) == 0){
+    s = (struct zslab*)pa;
+    s->next = 0;
+    s->used = 0;
+    s->size = size;
+    s->nobj = (PGSIZE - ZUNIT) / size;
+    s->nused = 0;
+    zram.partial[size / ZUNIT] = s;
+    zram.nslabs++;
+    *kept = 1;
+  }
+  for(i = 0; s->used & (1L << i); i++)
+    ;
+  s->used |= 1L << i;
+  if(++s->nused == s->nobj)
+    zram.partial[size / ZUNIT] = s->next;
+  o = (struct zobj*)((char*)s + ZUNIT + i*size);
+  o->len = n;
+  o->ref = 1;
+  memmove(o + 1, zram.buf, n);
+  zram.nstored++;
+  zram.nbytes += n;
+  release(&zram.lock);
+  return ((uint64)o - KERNBASE) / ZUNIT;
+}
+
+// Another PTE names h.
+void
+zdup(int h)
+{
+  acquire(&zram.lock);
+  zobj(h)->ref++;
+  release(&zram.lock);
+}
+
+// A PTE no longer names h.
+void
+zfree(int h)
+{
+  struct zobj *o = zobj(h);
+  struct zslab *s, **pp;
+  int i;
+
+  acquire(&zram.lock);
+  if(o->ref == 0)
+    panic("zfree");
+  if(--o->ref > 0){
+    release(&zram.lock);
+    return;
+  }
+  s = (struct zslab*)PGROUNDDOWN((uint64)o);
+  i = ((char*)o - (char*)s - ZUNIT) / s->size;
+  zram.nstored--;
+  zram.nbytes -= o->len;
+  s->used &= ~(1L << i);
+  if(s->nused-- == s->nobj){
+    // it was full, so it wasn't on the list.
+    s->next = zram.partial[s->size / ZUNIT];
+    zram.partial[s->size / ZUNIT] = s;
+  }
+  if(s->nused == 0){
+    for(pp = &zram.partial[s->size / ZUNIT]; *pp != s; pp = &(*pp)->next)
+      ;
+    *pp = s->next;
+    zram.nslabs--;
+    release(&zram.lock);
+    kfree(s);
+    return;
+  }
+  release(&zram.lock);
+}
+
+// Decompress h into the page dst, and drop the reference.
+void
+zload(int h, void *dst)
+{
+  struct zobj *o = zobj(h);
+
+  acquire(&zram.lock);
+  lzdecompress((uchar*)(o + 1), o->len, dst);
+  release(&zram.lock);
+  zfree(h);
+}
+
+void countZram(void* ptr) {
+  struct sysinfo* inf = (struct sysinfo*)ptr;
+  acquire(&zram.lock);
+  inf->nzstored = zram.nstored;
+  inf->nzbytes = zram.nbytes;
+  inf->nzpages = zram.nslabs;
+  release(&zram.lock);
+}
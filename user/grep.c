@@ -2,6 +2,7 @@
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/fcntl.h"
 #include "user/user.h"
 
 char buf[1024];
@@ -33,6 +34,37 @@ grep(char *pattern, int fd)
   }
 }
 
+// grep a regular file by mapping it instead of reading it
+// through buf. Returns -1 if fd can't be mapped, in which
+// case the caller should use grep().
+int
+grepmap(char *pattern, int fd)
+{
+  struct stat st;
+  char *data, *p, *q, *end;
+
+  if(fstat(fd, &st) < 0 || st.type != T_FILE || st.size == 0)
+    return -1;
+  // private and writable, so that lines can be terminated in place.
+  data = mmap(0, st.size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(data == MAP_FAILED)
+    return -1;
+  end = data + st.size;
+  for(p = data; p < end; p = q+1){
+    for(q = p; q < end && *q != '\n'; q++)
+      ;
+    if(q == end)
+      break;   // like grep(), ignore an unterminated last line
+    *q = 0;
+    if(match(pattern, p)){
+      *q = '\n';
+      write(1, p, q+1 - p);
+    }
+  }
+  munmap(data, st.size);
+  return 0;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -55,7 +87,8 @@ main(int argc, char *argv[])
       printf("grep: cannot open %s\n", argv[i]);
       exit(1);
     }
-    grep(pattern, fd);
+    if(grepmap(pattern, fd) < 0)
+      grep(pattern, fd);
     close(fd);
   }
   exit(0);
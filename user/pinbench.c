@@ -0,0 +1,88 @@
+// Pipe throughput with and without CPU affinity.
+//
+// A producer writes n KB down a pipe to a consumer, three
+// ways: with both free to run on any hart, with each pinned
+// to a hart of its own (0 and 1), and with both pinned to
+// hart 0. Pinned, neither bounces between harts and leaves
+// its cache behind. Needs at least two harts (make CPUS=2).
+//
+// usage: pinbench [KB]
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+char buf[512];
+
+// Move kb KB from a child pinned to the harts in pmask to
+// another pinned to those in cmask, or unpinned if 0, and
+// report the rate.
+void
+run(char *what, int kb, uint pmask, uint cmask)
+{
+  int fds[2], pid, n;
+  uint64 t0, t;
+  long total = (long)kb * 1024, got;
+
+  if(pipe(fds) < 0){
+    fprintf(2, "pinbench: pipe failed\n");
+    exit(1);
+  }
+  t0 = uptimens();
+  if((pid = fork()) < 0){
+    fprintf(2, "pinbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    if(pmask && sched_setaffinity(0, pmask) < 0){
+      fprintf(2, "pinbench: sched_setaffinity failed\n");
+      exit(1);
+    }
+    for(got = 0; got < total; got += sizeof(buf))
+      if(write(fds[1], buf, sizeof(buf)) != sizeof(buf))
+        exit(1);
+    exit(0);
+  }
+  close(fds[1]);
+  if(cmask && sched_setaffinity(0, cmask) < 0){
+    fprintf(2, "pinbench: sched_setaffinity failed\n");
+    exit(1);
+  }
+  for(got = 0; (n = read(fds[0], buf, sizeof(buf))) > 0; got += n)
+    ;
+  close(fds[0]);
+  wait(0);
+  // the parent is the consumer; free it again.
+  sched_setaffinity(0, ~0);
+  t = uptimens() - t0;
+  if(got != total){
+    fprintf(2, "pinbench: %s: got %d of %d bytes\n", what, (int)got, (int)total);
+    exit(1);
+  }
+  if(t == 0)
+    t = 1;
+  printf("%s: %d KB in %d ms, %d KB/s\n", what, kb, (int)(t / 1000000),
+         (int)(kb * 1000000000L / t));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int kb = 4096;
+
+  if(argc > 1)
+    kb = atoi(argv[1]);
+  if(kb <= 0){
+    fprintf(2, "usage: pinbench [KB]\n");
+    exit(1);
+  }
+  if(sched_getaffinity(0) < 0){
+    fprintf(2, "pinbench: sched_getaffinity failed\n");
+    exit(1);
+  }
+
+  run("unpinned", kb, 0, 0);
+  run("pinned to harts 0 and 1", kb, 1 << 0, 1 << 1);
+  run("both pinned to hart 0", kb, 1 << 0, 1 << 0);
+  exit(0);
+}
@@ -0,0 +1,86 @@
+// Pipe ping-pong benchmark.
+//
+// Two processes pass a byte back and forth n times over a pair
+// of pipes, and the round-trip time is reported, first with
+// both free to run on any hart and then with both pinned to
+// hart 0. Each one wakes the other and then sleeps, so the
+// kernel can switch straight from one to the other (see
+// handoff() in proc.c); compare a kernel built with make
+// NOHANDOFF=1.
+//
+// usage: pingbench [n]
+
+#include "kernel/types.h"
+#include "kernel/timepage.h"
+#include "user/user.h"
+
+uint64
+now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.sec * 1000000000 + ts.nsec;
+}
+
+void
+run(char *what, int n, uint mask)
+{
+  int ping[2], pong[2], pid, i;
+  uint64 t0, t;
+  char c = 0;
+
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    fprintf(2, "pingbench: pipe failed\n");
+    exit(1);
+  }
+  if(mask && sched_setaffinity(0, mask) < 0){
+    fprintf(2, "pingbench: sched_setaffinity failed\n");
+    exit(1);
+  }
+  if((pid = fork()) < 0){
+    fprintf(2, "pingbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(ping[1]);
+    close(pong[0]);
+    while(read(ping[0], &c, 1) == 1)
+      write(pong[1], &c, 1);
+    exit(0);
+  }
+  close(ping[0]);
+  close(pong[1]);
+
+  t0 = now();
+  for(i = 0; i < n; i++){
+    if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1){
+      fprintf(2, "pingbench: %s: round trip %d failed\n", what, i);
+      exit(1);
+    }
+  }
+  t = now() - t0;
+
+  close(ping[1]);
+  close(pong[0]);
+  wait(0);
+  sched_setaffinity(0, ~0);
+  printf("%s: %d round trips, %d ns each\n", what, n, (int)(t / n));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 10000;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n <= 0){
+    fprintf(2, "usage: pingbench [n]\n");
+    exit(1);
+  }
+
+  run("unpinned", n, 0);
+  run("both on hart 0", n, 1 << 0);
+  exit(0);
+}
@@ -0,0 +1,90 @@
+// Parallel sum benchmark for the pthread library.
+//
+// Sums an array with 1, 2, 4, ... threads up to max, each
+// summing a contiguous slice, and reports how long each took;
+// with as many harts (make CPUS=n), the time should fall about
+// in proportion to the threads, and the sums must agree.
+//
+// usage: psum [max threads [rounds]]
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define N      (256 * 1024)
+#define MAXT   16
+
+int *a;
+int rounds = 20;
+
+struct slice {
+  int lo, hi;
+  uint64 sum;
+  char pad[64];   // keep each thread's sum on its own cache line
+} slices[MAXT];
+
+void*
+sum(void *arg)
+{
+  struct slice *s = arg;
+  uint64 total = 0;
+  int r, i;
+
+  for(r = 0; r < rounds; r++)
+    for(i = s->lo; i < s->hi; i++)
+      total += a[i];
+  s->sum = total;
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  pthread_t t[MAXT];
+  uint64 total, first = 0;
+  int max = 4, n, i, t0;
+
+  if(argc > 1)
+    max = atoi(argv[1]);
+  if(argc > 2)
+    rounds = atoi(argv[2]);
+  if(max < 1 || max > MAXT || rounds < 1){
+    fprintf(2, "usage: psum [max threads [rounds]]\n");
+    exit(1);
+  }
+
+  a = (int*)sbrk(N * sizeof(int));
+  if(a == (int*)-1){
+    fprintf(2, "psum: sbrk failed\n");
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    a[i] = i % 1000;
+
+  for(n = 1; n <= max; n *= 2){
+    t0 = uptime();
+    for(i = 0; i < n; i++){
+      slices[i].lo = N / n * i;
+      slices[i].hi = i == n - 1 ? N : N / n * (i + 1);
+      if(pthread_create(&t[i], sum, &slices[i]) < 0){
+        fprintf(2, "psum: pthread_create failed\n");
+        exit(1);
+      }
+    }
+    total = 0;
+    for(i = 0; i < n; i++){
+      if(pthread_join(t[i], 0) < 0){
+        fprintf(2, "psum: pthread_join failed\n");
+        exit(1);
+      }
+      total += slices[i].sum;
+    }
+    printf("psum: %d threads: %d ticks\n", n, uptime() - t0);
+    if(n == 1)
+      first = total;
+    else if(total != first){
+      fprintf(2, "psum: sum %d with %d threads, %d with 1\n", (int)total, n, (int)first);
+      exit(1);
+    }
+  }
+  exit(0);
+}
@@ -0,0 +1,101 @@
+// A small pthread-like library on clone(), join() and futex().
+//
+// each thread runs on a stack from malloc(), with its struct
+// pthread at the top, where clone() points the thread's a0.
+// a thread ends by returning from its start routine.
+// malloc() has no lock, so pthread_create() and pthread_join()
+// mustn't run at the same time as each other or as malloc()
+// or free() in another thread.
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define STACKSIZE 8192
+
+struct pthread {
+  int tid;
+  char *stack;       // from malloc()
+  void *(*fn)(void*);
+  void *arg;
+  void *ret;         // what fn returned
+};
+
+static void
+start(void *arg)
+{
+  struct pthread *t = arg;
+
+  t->ret = t->fn(t->arg);
+  exit(0);
+}
+
+int
+pthread_create(pthread_t *tp, void *(*fn)(void*), void *arg)
+{
+  struct pthread *t;
+  char *stack;
+
+  if((stack = malloc(STACKSIZE)) == 0)
+    return -1;
+  // the stack pointer must be 16-byte aligned.
+  t = (struct pthread*)((uint64)(stack + STACKSIZE - sizeof(*t)) & ~15L);
+  t->stack = stack;
+  t->fn = fn;
+  t->arg = arg;
+  t->ret = 0;
+  if((t->tid = clone(start, t, CLONE_VM|CLONE_FILES)) < 0){
+    free(stack);
+    return -1;
+  }
+  *tp = t;
+  return 0;
+}
+
+int
+pthread_join(pthread_t t, void **ret)
+{
+  if(join(t->tid) < 0)
+    return -1;
+  if(ret)
+    *ret = t->ret;
+  free(t->stack);
+  return 0;
+}
+
+// A mutex is 0 if unlocked, 1 if locked, and 2 if locked and
+// there may be threads waiting for it in futex(), which only
+// pthread_mutex_unlock() of a 2 need wake.
+
+int
+pthread_mutex_init(pthread_mutex_t *m)
+{
+  m->state = 0;
+  return 0;
+}
+
+int
+pthread_mutex_lock(pthread_mutex_t *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return 0;
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->state, 2);
+  while(c != 0){
+    futex(&m->state, FUTEX_WAIT, 2);
+    c = __sync_lock_test_and_set(&m->state, 2);
+  }
+  return 0;
+}
+
+int
+pthread_mutex_unlock(pthread_mutex_t *m)
+{
+  if(__sync_fetch_and_sub(&m->state, 1) != 1){
+    __sync_lock_release(&m->state);
+    futex(&m->state, FUTEX_WAKE, 1);
+  }
+  return 0;
+}
@@ -0,0 +1,75 @@
+// fork() and wait() benchmark.
+//
+// Forks n children that exit at once, reaping each before
+// forking the next, while b more children sit in the
+// background blocked on a pipe, as a shell's jobs might.
+// wait() and exit() only look at the children of the process
+// concerned, so the rate shouldn't depend much on b.
+//
+// usage: reapbench [n [background]]
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  int n = 10000, b = 0;
+  int fds[2], i, pid;
+  uint64 t0, t;
+  char c;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(argc > 2)
+    b = atoi(argv[2]);
+  if(n <= 0 || b < 0){
+    fprintf(2, "usage: reapbench [n [background]]\n");
+    exit(1);
+  }
+
+  if(pipe(fds) < 0){
+    fprintf(2, "reapbench: pipe failed\n");
+    exit(1);
+  }
+  for(i = 0; i < b; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "reapbench: only %d background children\n", i);
+      b = i;
+      break;
+    }
+    if(pid == 0){
+      close(fds[1]);
+      read(fds[0], &c, 1);
+      exit(0);
+    }
+  }
+  close(fds[0]);
+
+  t0 = uptimens();
+  for(i = 0; i < n; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "reapbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      exit(0);
+    if(wait(0) != pid){
+      fprintf(2, "reapbench: wait reaped the wrong child\n");
+      exit(1);
+    }
+  }
+  t = uptimens() - t0;
+  if(t == 0)
+    t = 1;
+  printf("reapbench: %d forks and waits with %d in the background: "
+         "%d ms, %d/s\n", n, b, (int)(t / 1000000), (int)(n * 1000000000L / t));
+
+  // end the background children.
+  close(fds[1]);
+  for(i = 0; i < b; i++)
+    wait(0);
+  exit(0);
+}
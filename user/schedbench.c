@@ -0,0 +1,124 @@
+// Scheduler benchmark: interactive response time under a
+// CPU-bound batch load.
+//
+// Starts b batch processes that spin, and i interactive ones
+// that each nanosleep() for 10ms n times and note how many
+// microseconds late they were to run again, which is mostly
+// how long they waited behind the batch processes. Prints
+// percentiles of the lateness over all the interactive
+// wakeups. Compare a kernel built with make SCHED=MLFQ against
+// the default round robin.
+//
+// usage: schedbench [batch [interactive [rounds]]]
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define MAXSAMPLES 4096
+#define MAXBATCH   64
+#define NAPNS      10000000   // how long an interactive process sleeps
+
+int late[MAXSAMPLES];
+
+void
+spin(void)
+{
+  volatile uint64 x = 0;
+
+  for(;;)
+    x++;
+}
+
+void
+interact(int fd, int rounds)
+{
+  volatile uint64 x = 0;
+  uint64 t0, t;
+  int r, d;
+
+  for(r = 0; r < rounds; r++){
+    t0 = uptimens();
+    nanosleep(NAPNS);
+    t = uptimens() - t0;
+    d = t > NAPNS ? (t - NAPNS) / 1000 : 0;
+    write(fd, &d, sizeof(d));
+    // a little work, as for a keystroke.
+    for(int i = 0; i < 10000; i++)
+      x++;
+  }
+  exit(0);
+}
+
+// the p'th percentile of the sorted a[0..n-1].
+int
+pct(int *a, int n, int p)
+{
+  int i = n * p / 100;
+
+  return a[i < n ? i : n - 1];
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nbatch = 4, ninter = 2, rounds = 50;
+  int batch[MAXBATCH], fds[2], i, j, n, v;
+
+  if(argc > 1)
+    nbatch = atoi(argv[1]);
+  if(argc > 2)
+    ninter = atoi(argv[2]);
+  if(argc > 3)
+    rounds = atoi(argv[3]);
+  if(nbatch < 0 || nbatch > MAXBATCH || ninter < 1 || rounds < 1 ||
+     ninter * rounds > MAXSAMPLES){
+    fprintf(2, "usage: schedbench [batch [interactive [rounds]]]\n");
+    exit(1);
+  }
+
+  if(pipe(fds) < 0){
+    fprintf(2, "schedbench: pipe failed\n");
+    exit(1);
+  }
+  for(i = 0; i < nbatch; i++){
+    if((batch[i] = fork()) < 0){
+      fprintf(2, "schedbench: fork failed\n");
+      exit(1);
+    }
+    if(batch[i] == 0)
+      spin();
+  }
+  for(i = 0; i < ninter; i++){
+    if((v = fork()) < 0){
+      fprintf(2, "schedbench: fork failed\n");
+      exit(1);
+    }
+    if(v == 0){
+      close(fds[0]);
+      interact(fds[1], rounds);
+    }
+  }
+  close(fds[1]);
+
+  for(n = 0; n < MAXSAMPLES && read(fds[0], &v, sizeof(v)) == sizeof(v); n++){
+    // insertion sort as they come.
+    for(j = n; j > 0 && late[j-1] > v; j--)
+      late[j] = late[j-1];
+    late[j] = v;
+  }
+  close(fds[0]);
+
+  for(i = 0; i < nbatch; i++)
+    kill(batch[i]);
+  for(i = 0; i < nbatch + ninter; i++)
+    wait(0);
+
+  if(n == 0){
+    fprintf(2, "schedbench: no samples\n");
+    exit(1);
+  }
+  printf("schedbench: %d batch, %d interactive, %d wakeups\n", nbatch, ninter, n);
+  printf("us late: p50 %d p90 %d p99 %d max %d\n",
+         pct(late, n, 50), pct(late, n, 90), pct(late, n, 99), late[n-1]);
+  exit(0);
+}
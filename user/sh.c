@@ -52,6 +52,7 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
 
 // Execute cmd.  Never returns.
 void
@@ -130,6 +131,77 @@ runcmd(struct cmd *cmd)
   exit(0);
 }
 
+// Can cmd be run with spawn(), straight from the shell?
+// Simple commands and pipelines of them can, with redirections.
+int
+spawnable(struct cmd *cmd)
+{
+  switch(cmd->type){
+  case EXEC:
+    return 1;
+  case REDIR:
+    return spawnable(((struct redircmd*)cmd)->cmd);
+  case PIPE:
+    return spawnable(((struct pipecmd*)cmd)->left) &&
+           spawnable(((struct pipecmd*)cmd)->right);
+  }
+  return 0;
+}
+
+// Start the commands of cmd, a spawnable() one, with spawn(),
+// giving them fds[0..2] as file descriptors 0..2.
+// Returns how many processes it started.
+int
+spawncmd(struct cmd *cmd, int *fds)
+{
+  int p[2], sub[3], fd, n;
+  struct execcmd *ecmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  memmove(sub, fds, sizeof(sub));
+  switch(cmd->type){
+  case EXEC:
+    ecmd = (struct execcmd*)cmd;
+    if(ecmd->argv[0] == 0)
+      return 0;
+    if(spawn(ecmd->argv[0], ecmd->argv, fds, 3) < 0){
+      fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    return 1;
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    if((fd = open(rcmd->file, rcmd->mode)) < 0){
+      fprintf(2, "open %s failed\n", rcmd->file);
+      return 0;
+    }
+    sub[rcmd->fd] = fd;
+    n = spawncmd(rcmd->cmd, sub);
+    close(fd);
+    return n;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    // this is the shell itself, so it mustn't exit.
+    if(pipe(p) < 0){
+      fprintf(2, "pipe failed\n");
+      return 0;
+    }
+    sub[1] = p[1];
+    n = spawncmd(pcmd->left, sub);
+    sub[1] = fds[1];
+    sub[0] = p[0];
+    n += spawncmd(pcmd->right, sub);
+    close(p[0]);
+    close(p[1]);
+    return n;
+  }
+  panic("spawncmd");
+  return 0;
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -145,7 +217,9 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  static int fds[3] = { 0, 1, 2 };
+  struct cmd *cmd;
+  int fd, n;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -164,9 +238,18 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait(0);
+    if((cmd = parsecmd(buf)) == 0)
+      continue;
+    if(spawnable(cmd)){
+      // no need to copy the shell just to exec() in the copy.
+      for(n = spawncmd(cmd, fds); n > 0; n--)
+        wait(0);
+    } else {
+      if(fork1() == 0)
+        runcmd(cmd);
+      wait(0);
+    }
+    freecmd(cmd);
   }
   exit(0);
 }
@@ -319,6 +402,18 @@ peek(char **ps, char *es, char *toks)
   return *s && strchr(toks, *s);
 }
 
+// the shell itself parses each line, so a syntax error
+// mustn't exit(); it sets this, and parsecmd() returns 0.
+int syntaxerr;
+
+void
+syntax(char *msg)
+{
+  if(!syntaxerr)
+    fprintf(2, "%s\n", msg);
+  syntaxerr = 1;
+}
+
 struct cmd *parseline(char**, char*);
 struct cmd *parsepipe(char**, char*);
 struct cmd *parseexec(char**, char*);
@@ -330,12 +425,17 @@ parsecmd(char *s)
   char *es;
   struct cmd *cmd;
 
+  syntaxerr = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && !syntaxerr){
     fprintf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
+  }
+  if(syntaxerr){
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -379,8 +479,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -405,8 +507,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -431,13 +535,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
+    if(argc >= MAXARGS - 1){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -491,3 +599,24 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+void
+freecmd(struct cmd *cmd)
+{
+  if(cmd == 0)
+    return;
+  switch(cmd->type){
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+  case PIPE:
+  case LIST:
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+    break;
+  case BACK:
+    freecmd(((struct backcmd*)cmd)->cmd);
+    break;
+  }
+  free(cmd);
+}
@@ -0,0 +1,102 @@
+// Sleep accuracy benchmark.
+//
+// Sleeps n times for each of a range of lengths with
+// nanosleep() and reports how long after the asked-for time
+// the sleeper got back, as measured by uptimens(); then how
+// long sleep(1) takes, for comparison. nanosleep() sets a
+// one-shot timer for its deadline, so it should be late by
+// far less than sleep() can be, which only wakes on a tick
+// (make TICK= sets its length). With spinning processes (the
+// second argument), the sleeper may also wait for a hart.
+//
+// usage: sleepbench [n [spinners]]
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define MAXSPIN 16
+
+// how late each sleep was, in microseconds.
+int late[1000];
+
+// the p'th percentile of the sorted a[0..n-1].
+int
+pct(int *a, int n, int p)
+{
+  int i = n * p / 100;
+
+  return a[i < n ? i : n - 1];
+}
+
+// Sleep n times for ns nanoseconds, or a tick with sleep() if
+// ns is 0, and report.
+void
+run(int n, uint64 ns)
+{
+  uint64 t0, t;
+  int i, j, v;
+
+  for(i = 0; i < n; i++){
+    t0 = uptimens();
+    if(ns)
+      nanosleep(ns);
+    else
+      sleep(1);
+    t = uptimens() - t0;
+    // sleep(1) only waits for the next tick, which may be
+    // any time up to a tick away, so report all of it.
+    if(ns == 0)
+      v = t / 1000;
+    else
+      v = t > ns ? (t - ns) / 1000 : 0;
+    // insertion sort as they come.
+    for(j = i; j > 0 && late[j-1] > v; j--)
+      late[j] = late[j-1];
+    late[j] = v;
+  }
+  if(ns)
+    printf("nanosleep(%d us): late by us: p50 %d p90 %d p99 %d max %d\n",
+           (int)(ns / 1000), pct(late, n, 50), pct(late, n, 90),
+           pct(late, n, 99), late[n-1]);
+  else
+    printf("sleep(1): took us: p50 %d p90 %d p99 %d max %d\n",
+           pct(late, n, 50), pct(late, n, 90), pct(late, n, 99), late[n-1]);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 100, nspin = 0, i;
+  int spin[MAXSPIN];
+  uint64 ns;
+  volatile uint64 x = 0;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(argc > 2)
+    nspin = atoi(argv[2]);
+  if(n < 1 || n > sizeof(late)/sizeof(late[0]) || nspin < 0 || nspin > MAXSPIN){
+    fprintf(2, "usage: sleepbench [n [spinners]]\n");
+    exit(1);
+  }
+
+  for(i = 0; i < nspin; i++){
+    if((spin[i] = fork()) < 0){
+      fprintf(2, "sleepbench: fork failed\n");
+      exit(1);
+    }
+    if(spin[i] == 0)
+      for(;;)
+        x++;
+  }
+
+  for(ns = 100000; ns <= 10000000; ns *= 10)
+    run(n, ns);
+  run(n < 20 ? n : 20, 0);
+
+  for(i = 0; i < nspin; i++)
+    kill(spin[i]);
+  for(i = 0; i < nspin; i++)
+    wait(0);
+  exit(0);
+}
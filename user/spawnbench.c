@@ -0,0 +1,77 @@
+// Process creation benchmark: spawn() against fork() + exec().
+//
+// Starts a program that exits at once, n times each way, from
+// a parent with a heap of the given size, which fork() must
+// copy (or at least its page table) and spawn() never touches.
+// The program is this one, run with argument "-x".
+//
+// usage: spawnbench [iterations [heap KB]]
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+// report the rate, given the time taken in nanoseconds.
+void
+report(char *what, int n, uint64 ns)
+{
+  printf("%s: %d in %d ms, %d/s\n", what, n, (int)(ns / 1000000),
+         (int)(n * 1000000000L / (ns ? ns : 1)));
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *args[] = { "spawnbench", "-x", 0 };
+  int n = 200, kb = 4096;
+  int i, pid;
+  uint64 t0;
+  char *heap;
+
+  if(argc > 1 && strcmp(argv[1], "-x") == 0)
+    exit(0);
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(argc > 2)
+    kb = atoi(argv[2]);
+  if(n <= 0 || kb < 0){
+    fprintf(2, "usage: spawnbench [iterations [heap KB]]\n");
+    exit(1);
+  }
+
+  heap = sbrk(kb * 1024);
+  if(heap == (char*)-1){
+    fprintf(2, "spawnbench: sbrk failed\n");
+    exit(1);
+  }
+  for(i = 0; i < kb * 1024; i += PGSIZE)
+    heap[i] = 1;
+  printf("spawnbench: %d KB heap\n", kb);
+
+  t0 = uptimens();
+  for(i = 0; i < n; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "spawnbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(args[0], args);
+      exit(1);
+    }
+    wait(0);
+  }
+  report("fork+exec", n, uptimens() - t0);
+
+  t0 = uptimens();
+  for(i = 0; i < n; i++){
+    if(spawn(args[0], args, 0, 0) < 0){
+      fprintf(2, "spawnbench: spawn failed\n");
+      exit(1);
+    }
+    wait(0);
+  }
+  report("spawn", n, uptimens() - t0);
+
+  exit(0);
+}
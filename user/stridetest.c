@@ -0,0 +1,86 @@
+// Test of the stride scheduler (make SCHED=STRIDE).
+//
+// Runs CPU-bound processes with 1, 2 and 3 times NTICKETS
+// tickets, k of each so that there are more of them than
+// harts, for t ticks, and checks that the ticks each group
+// got are within 5 points of 1/6, 2/6 and 3/6 of the total.
+// The children get their tickets from fork(), after the
+// parent sets its own.
+//
+// usage: stridetest [k [ticks]]
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+#define MAXK 8
+
+int
+main(int argc, char *argv[])
+{
+  int k = 3, t = 50;
+  int pids[3][MAXK], got[3], total, i, j, share, want;
+  volatile uint64 x = 0;
+  int ok = 1;
+
+  if(argc > 1)
+    k = atoi(argv[1]);
+  if(argc > 2)
+    t = atoi(argv[2]);
+  if(k < 1 || k > MAXK || t < 1){
+    fprintf(2, "usage: stridetest [k [ticks]]\n");
+    exit(1);
+  }
+
+  for(i = 0; i < 3; i++){
+    if(settickets((i + 1) * NTICKETS) < 0){
+      fprintf(2, "stridetest: settickets failed\n");
+      exit(1);
+    }
+    for(j = 0; j < k; j++){
+      if((pids[i][j] = fork()) < 0){
+        fprintf(2, "stridetest: fork failed\n");
+        exit(1);
+      }
+      if(pids[i][j] == 0)
+        for(;;)
+          x++;
+    }
+  }
+  // the parent needs to run to wake up on time.
+  settickets(NTICKETS * 10);
+  sleep(t);
+
+  total = 0;
+  for(i = 0; i < 3; i++){
+    got[i] = 0;
+    for(j = 0; j < k; j++)
+      got[i] += getticks(pids[i][j]);
+    total += got[i];
+  }
+  for(i = 0; i < 3; i++)
+    for(j = 0; j < k; j++)
+      kill(pids[i][j]);
+  for(i = 0; i < 3 * k; i++)
+    wait(0);
+
+  if(total <= 0){
+    fprintf(2, "stridetest: no ticks counted\n");
+    exit(1);
+  }
+  for(i = 0; i < 3; i++){
+    // shares in tenths of a percent.
+    share = got[i] * 1000 / total;
+    want = (i + 1) * 1000 / 6;
+    printf("stridetest: %d tickets: %d ticks, %d.%d%% (want %d.%d%%)\n",
+           (i + 1) * NTICKETS, got[i], share / 10, share % 10, want / 10, want % 10);
+    if(share < want - 50 || share > want + 50)
+      ok = 0;
+  }
+  if(!ok){
+    printf("stridetest: FAILED\n");
+    exit(1);
+  }
+  printf("stridetest: OK\n");
+  exit(0);
+}
@@ -0,0 +1,78 @@
+// System call latency benchmark.
+//
+// Times a null system call; a system call followed by
+// touching a working set of pages, the case where keeping user
+// TLB entries across traps (ASIDs) pays off (compare a kernel
+// built with make NOASID=1); and a write and read of a pipe,
+// which is mostly copyin() and copyout().
+//
+// usage: sysbench [iterations]
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NPAGES 32
+
+// report per-call cost, given the total in nanoseconds.
+void
+report(char *what, int n, uint64 ns)
+{
+  printf("%s: %d calls in %d us, %d ns/call\n", what, n,
+         (int)(ns / 1000), (int)(ns / n));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 200000;
+  int i, j;
+  uint64 t0;
+  int fds[2];
+  char *ws;
+  static char buf[512];
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n <= 0){
+    fprintf(2, "usage: sysbench [iterations]\n");
+    exit(1);
+  }
+
+  ws = sbrk(NPAGES * PGSIZE);
+  if(ws == (char*)-1){
+    fprintf(2, "sysbench: sbrk failed\n");
+    exit(1);
+  }
+  for(j = 0; j < NPAGES; j++)
+    ws[j * PGSIZE] = 1;
+
+  t0 = uptimens();
+  for(i = 0; i < n; i++)
+    getpid();
+  report("getpid", n, uptimens() - t0);
+
+  t0 = uptimens();
+  for(i = 0; i < n; i++){
+    getpid();
+    for(j = 0; j < NPAGES; j++)
+      ws[j * PGSIZE]++;
+  }
+  report("getpid+touch", n, uptimens() - t0);
+
+  if(pipe(fds) < 0){
+    fprintf(2, "sysbench: pipe failed\n");
+    exit(1);
+  }
+  t0 = uptimens();
+  for(i = 0; i < n; i++){
+    if(write(fds[1], buf, sizeof(buf)) != sizeof(buf) ||
+       read(fds[0], buf, sizeof(buf)) != sizeof(buf)){
+      fprintf(2, "sysbench: pipe i/o failed\n");
+      exit(1);
+    }
+  }
+  report("pipe write+read 512", n, uptimens() - t0);
+
+  exit(0);
+}
@@ -0,0 +1,72 @@
+// Cost of telling the time: the uptime() and uptimens() system
+// calls against clock_gettime(), which reads the kernel's time
+// page and the time CSR without entering the kernel, and a
+// plain read of the tick count in the page.
+//
+// usage: timebench [n]
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
+#include "kernel/timepage.h"
+#include "user/user.h"
+
+uint64
+now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.sec * 1000000000 + ts.nsec;
+}
+
+void
+report(char *what, int n, uint64 t0)
+{
+  uint64 t = now() - t0;
+
+  printf("%s: %d calls, %d ns each\n", what, n, (int)(t / n));
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct timepage *tp = (struct timepage *)TIMEPAGE;
+  struct timespec ts;
+  volatile uint x;
+  uint64 t0;
+  int n = 100000, i;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n <= 0){
+    fprintf(2, "usage: timebench [n]\n");
+    exit(1);
+  }
+
+  t0 = now();
+  for(i = 0; i < n; i++)
+    x = uptime();
+  report("uptime()", n, t0);
+
+  t0 = now();
+  for(i = 0; i < n; i++)
+    x = uptimens();
+  report("uptimens()", n, t0);
+
+  t0 = now();
+  for(i = 0; i < n; i++)
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+  report("clock_gettime()", n, t0);
+
+  t0 = now();
+  for(i = 0; i < n; i++)
+    x = tp->ticks;
+  report("time page ticks", n, t0);
+  (void)x;
+
+  if(clock_gettime(CLOCK_REALTIME, &ts) == 0)
+    printf("%d seconds since 1970\n", (int)ts.sec);
+  exit(0);
+}
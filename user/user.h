@@ -2,6 +2,7 @@ struct stat;
 struct rtcdate;
 // Add
 struct sysinfo;
+struct timespec;
 // 用户态程序跳板函数
 
 // system calls
@@ -43,7 +44,32 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+int clock_gettime(int, struct timespec*);
 
 // Add
 int trace(int);
-int sysinfo(struct sysinfo *);
\ No newline at end of file
+int sysinfo(struct sysinfo *);
+void *mmap(void*, uint64, int, int, int, uint64);
+int munmap(void*, uint64);
+int clone(void (*)(void*), void*, int);
+int join(int);
+int futex(int*, int, int);
+int spawn(char*, char**, int*, int);
+int vfork(void);
+int settickets(int);
+int getticks(int);
+int sched_setaffinity(int, uint);
+int sched_getaffinity(int);
+int nanosleep(uint64);
+uint64 uptimens(void);
+
+// pthread.c
+typedef struct pthread *pthread_t;
+typedef struct {
+  int state;
+} pthread_mutex_t;
+int pthread_create(pthread_t*, void *(*)(void*), void*);
+int pthread_join(pthread_t, void**);
+int pthread_mutex_init(pthread_mutex_t*);
+int pthread_mutex_lock(pthread_mutex_t*);
+int pthread_mutex_unlock(pthread_mutex_t*);
\ No newline at end of file
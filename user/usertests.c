@@ -7,6 +7,8 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/sysinfo.h"
+#include "kernel/timepage.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -680,6 +682,124 @@ exectest(char *s)
 
 }
 
+// spawn() runs a program in a new process, with the
+// file descriptors it is given.
+void
+spawntest(char *s)
+{
+  char *echoargv[] = { "echo", "spawned", 0 };
+  int fds[2], map[3], pid, xstatus, n;
+  char buf[16];
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  map[0] = -1;
+  map[1] = fds[1];
+  map[2] = 2;
+  if((pid = spawn("echo", echoargv, map, 3)) < 0){
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  n = read(fds[0], buf, sizeof(buf) - 1);
+  close(fds[0]);
+  if(n != 8 || memcmp(buf, "spawned\n", 8) != 0){
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+
+  if(spawn("nonexistent", echoargv, 0, 0) >= 0){
+    printf("%s: spawn of nonexistent succeeded\n", s);
+    exit(1);
+  }
+  map[0] = NOFILE - 1;   // not open
+  if(spawn("echo", echoargv, map, 3) >= 0){
+    printf("%s: spawn with a bad fd succeeded\n", s);
+    exit(1);
+  }
+}
+
+// vfork() runs the child in the parent's memory, with the
+// parent stopped until the child exits or execs.
+int vforkval;
+
+void
+vforktest(char *s)
+{
+  char *echoargv[] = { "echo", "OK", 0 };
+  int pid, xstatus;
+  char *m;
+
+  vforkval = 0;
+  pid = vfork();
+  if(pid < 0){
+    printf("%s: vfork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // the memory isn't the child's to change the size of.
+    vforkval = sbrk(PGSIZE) == (char*)-1 ? 1 : 2;
+    exit(7);
+  }
+  if(vforkval != 1){
+    printf("%s: child's store not seen, or sbrk succeeded\n", s);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 7){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+
+  pid = vfork();
+  if(pid < 0){
+    printf("%s: vfork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    exec("echo", echoargv);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: vfork+exec failed\n", s);
+    exit(1);
+  }
+
+  // the child can use the pages of the parent's mmap() regions
+  // that are in, but not fault in the others.
+  m = mmap(0, 2*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(m == MAP_FAILED){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  m[0] = 'm';
+  pid = vfork();
+  if(pid < 0){
+    printf("%s: vfork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(m[0] != 'm')
+      exit(1);
+    m[PGSIZE] = 'x';
+    exit(2);
+  }
+  if(wait(&xstatus) != pid || xstatus != -1){
+    printf("%s: child touching mmap region: status %d, not killed\n", s, xstatus);
+    exit(1);
+  }
+  if(m[0] != 'm' || m[PGSIZE] != 0){
+    printf("%s: mmap region changed by killed child\n", s);
+    exit(1);
+  }
+  munmap(m, 2*PGSIZE);
+}
+
 // simple fork and pipe read/write
 
 void
@@ -1913,12 +2033,13 @@ iref(char *s)
 }
 
 // test that fork fails gracefully
-// the forktest binary also does this, but it runs out of proc entries first.
+// the forktest binary also does this, but it may run out of proc entries first.
 // inside the bigger usertests binary, we run out of memory first.
 void
 forktest(char *s)
 {
-  enum{ N = 1000 };
+  // more than the proc table holds, whatever MEM is.
+  enum{ N = NPROC + 1 };
   int n, pid;
 
   for(n=0; n<N; n++){
@@ -1935,7 +2056,7 @@ forktest(char *s)
   }
 
   if(n == N){
-    printf("%s: fork claimed to work 1000 times!\n", s);
+    printf("%s: fork claimed to work %d times!\n", s, N);
     exit(1);
   }
 
@@ -1952,6 +2073,147 @@ forktest(char *s)
   }
 }
 
+// sched_setaffinity() pins to hart 0, and fork() inherits it.
+void
+affinitytest(char *s)
+{
+  int all, pid, xstatus;
+
+  if((all = sched_getaffinity(0)) == 0 || all == -1){
+    printf("%s: sched_getaffinity failed\n", s);
+    exit(1);
+  }
+  if(sched_setaffinity(0, 0) >= 0){
+    printf("%s: empty mask accepted\n", s);
+    exit(1);
+  }
+  if(sched_setaffinity(0, 1) < 0 || sched_getaffinity(0) != 1){
+    printf("%s: sched_setaffinity failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(sched_getaffinity(getpid()) == 1 ? 0 : 1);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child didn't inherit the mask\n", s);
+    exit(1);
+  }
+  sched_setaffinity(0, all);
+}
+
+// nanosleep() never wakes early, and kill() ends it.
+void
+nanosleeptest(char *s)
+{
+  uint64 t0, t;
+  int pid, xstatus;
+
+  t0 = uptimens();
+  if(nanosleep(20000000) < 0){
+    printf("%s: nanosleep failed\n", s);
+    exit(1);
+  }
+  t = uptimens() - t0;
+  if(t < 20000000){
+    printf("%s: woke after %d us, not 20000\n", s, (int)(t / 1000));
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    nanosleep(1000000000L * 1000);
+    exit(0);
+  }
+  sleep(1);
+  kill(pid);
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: kill didn't end nanosleep\n", s);
+    exit(1);
+  }
+}
+
+// clock_gettime() reads the time page without a system call;
+// it should agree with the kernel's clocks.
+void
+clocktest(char *s)
+{
+  struct timepage *tp = (struct timepage *)TIMEPAGE;
+  struct timespec ts;
+  uint64 a, b, c;
+  int i;
+
+  for(i = 0; i < 100; i++){
+    a = uptimens();
+    if(clock_gettime(CLOCK_MONOTONIC, &ts) < 0){
+      printf("%s: clock_gettime failed\n", s);
+      exit(1);
+    }
+    b = ts.sec * 1000000000 + ts.nsec;
+    c = uptimens();
+    if(b < a || b > c){
+      printf("%s: clock_gettime out of step with uptimens\n", s);
+      exit(1);
+    }
+  }
+  if(clock_gettime(42, &ts) >= 0){
+    printf("%s: bad clock accepted\n", s);
+    exit(1);
+  }
+  a = uptime();
+  b = tp->ticks;
+  if(b < a || b > a + 1){
+    printf("%s: time page ticks %d, uptime %d\n", s, (int)b, (int)a);
+    exit(1);
+  }
+}
+
+// more processes at once than the old fixed table of 64,
+// each of which kill() finds by pid.
+void
+manyprocs(char *s)
+{
+  enum{ N = 200 };
+  int pids[N], n, i, xstatus;
+
+  for(n = 0; n < N; n++){
+    pids[n] = fork();
+    if(pids[n] < 0){
+      printf("%s: fork %d failed\n", s, n);
+      break;
+    }
+    if(pids[n] == 0){
+      for(;;)
+        sleep(1000);
+    }
+  }
+  for(i = 0; i < n; i++){
+    if(kill(pids[i]) < 0){
+      printf("%s: kill %d failed\n", s, pids[i]);
+      exit(1);
+    }
+  }
+  for(i = 0; i < n; i++){
+    if(wait(&xstatus) < 0){
+      printf("%s: wait stopped early\n", s);
+      exit(1);
+    }
+  }
+  if(n < N || kill(pids[0]) >= 0){
+    printf("%s: failed\n", s);
+    exit(1);
+  }
+}
+
 void
 sbrkbasic(char *s)
 {
@@ -2076,6 +2338,476 @@ sbrkmuch(char *s)
   }
 }
 
+// fill a page with words that don't compress (if random)
+// or do, and check it later.
+static uint
+swapword(int random, uint page, int i)
+{
+  if(!random)
+    return page;
+  return (page * 4096 + i) * 1103515245 + 12345;
+}
+
+static void
+swapfill(char *a, int random, uint page)
+{
+  for(int i = 0; i < PGSIZE/4; i++)
+    ((uint*)a)[i] = swapword(random, page, i);
+}
+
+static int
+swapcheck(char *a, int random, uint page)
+{
+  for(int i = 0; i < PGSIZE/4; i++)
+    if(((uint*)a)[i] != swapword(random, page, i))
+      return 0;
+  return 1;
+}
+
+// grow the heap a page at a time to 4MB more than is free,
+// every page of it random, so that some of it must be swapped
+// out to disk, and check that it all comes back.
+void
+swapout(char *s)
+{
+  struct sysinfo before, after;
+  int i, n;
+  char *base, *a;
+
+  if(sysinfo(&before) < 0){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  n = before.freemem / PGSIZE + 1024;
+  base = sbrk(0);
+  for(i = 0; i < n; i++){
+    if((a = sbrk(PGSIZE)) == (char*)-1){
+      printf("%s: sbrk failed after %d of %d pages\n", s, i, n);
+      exit(1);
+    }
+    swapfill(a, 1, i);
+  }
+
+  for(i = 0; i < n; i++){
+    if(!swapcheck(base + i*PGSIZE, 1, i)){
+      printf("%s: page %d lost\n", s, i);
+      exit(1);
+    }
+  }
+
+  if(sysinfo(&after) < 0){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  if(after.nswapout == before.nswapout || after.nswapin == before.nswapin){
+    printf("%s: no swapping (out %d, in %d)\n", s,
+           (int)(after.nswapout - before.nswapout), (int)(after.nswapin - before.nswapin));
+    exit(1);
+  }
+}
+
+// like swapout, but with pages that compress well, except
+// every eighth, so that most are kept compressed in memory.
+void
+zramtest(char *s)
+{
+  struct sysinfo before, mid;
+  int i, n;
+  char *base, *a;
+
+  if(sysinfo(&before) < 0){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  n = before.freemem / PGSIZE + 1024;
+  base = sbrk(0);
+  for(i = 0; i < n; i++){
+    if((a = sbrk(PGSIZE)) == (char*)-1){
+      printf("%s: sbrk failed after %d of %d pages\n", s, i, n);
+      exit(1);
+    }
+    swapfill(a, i % 8 == 0, i);
+  }
+
+  if(sysinfo(&mid) < 0){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  if(mid.nzstored <= before.nzstored || mid.nzpages >= mid.nzstored){
+    printf("%s: zram holds %d pages in %d\n", s, (int)mid.nzstored, (int)mid.nzpages);
+    exit(1);
+  }
+
+  for(i = 0; i < n; i++){
+    if(!swapcheck(base + i*PGSIZE, i % 8 == 0, i)){
+      printf("%s: page %d lost\n", s, i);
+      exit(1);
+    }
+  }
+}
+
+// pages with the same contents should be merged by ksmd
+// while we sleep, and come apart again when written.
+void
+ksmtest(char *s)
+{
+  struct sysinfo inf;
+  int i, t, n = 32;
+  char *base;
+
+  base = sbrk(n * PGSIZE);
+  if(base == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n * PGSIZE; i++)
+    base[i] = i % PGSIZE % 251;
+
+  for(t = 0; t < 100; t++){
+    if(sysinfo(&inf) < 0){
+      printf("%s: sysinfo failed\n", s);
+      exit(1);
+    }
+    if(inf.nksm >= n / 2)
+      break;
+    sleep(1);
+  }
+  if(t == 100){
+    printf("%s: only %d pages merged\n", s, (int)inf.nksm);
+    exit(1);
+  }
+
+  for(i = 0; i < n; i += 2)
+    base[i * PGSIZE + 7] = 'x';
+  for(i = 0; i < n * PGSIZE; i++){
+    if(base[i] != ((i / PGSIZE) % 2 == 0 && i % PGSIZE == 7 ? 'x' : i % PGSIZE % 251)){
+      printf("%s: byte %d of merged pages is wrong\n", s, i);
+      exit(1);
+    }
+  }
+}
+
+// threads share memory and are waited for with join(); a
+// mutex built on futex() keeps their increments apart, and
+// exit() in the first thread takes the others with it.
+pthread_mutex_t threadmu;
+int threadcount;
+
+void*
+threadinc(void *arg)
+{
+  int i;
+
+  for(i = 0; i < 1000; i++){
+    pthread_mutex_lock(&threadmu);
+    threadcount++;
+    pthread_mutex_unlock(&threadmu);
+  }
+  return arg;
+}
+
+void*
+threadspin(void *arg)
+{
+  for(;;)
+    ;
+}
+
+void
+threadtest(char *s)
+{
+  pthread_t t[4];
+  void *ret;
+  int i, pid, xstatus;
+
+  if(clone(0, 0, CLONE_VM) >= 0){
+    printf("%s: clone without CLONE_FILES succeeded\n", s);
+    exit(1);
+  }
+
+  pthread_mutex_init(&threadmu);
+  for(i = 0; i < 4; i++){
+    if(pthread_create(&t[i], threadinc, (void*)(uint64)i) < 0){
+      printf("%s: pthread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < 4; i++){
+    if(pthread_join(t[i], &ret) < 0 || ret != (void*)(uint64)i){
+      printf("%s: pthread_join failed\n", s);
+      exit(1);
+    }
+  }
+  if(threadcount != 4000){
+    printf("%s: count is %d, not 4000\n", s, threadcount);
+    exit(1);
+  }
+  if(join(getpid()) >= 0){
+    printf("%s: joined itself\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(pthread_create(&t[0], threadspin, 0) < 0)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: thread didn't start\n", s);
+    exit(1);
+  }
+}
+
+// the kernel direct-maps RAM with 2MB superpages, so its page
+// table should need far fewer pages than the level-0 page per
+// 2MB of RAM that mapping it with 4KB pages would take.
+void
+kvmsuper(char *s)
+{
+  struct sysinfo inf;
+
+  if(sysinfo(&inf) < 0){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  if(inf.nkpt * SPGSIZE >= inf.freemem){
+    printf("%s: %d page-table pages for %dMB free\n", s,
+           (int)inf.nkpt, (int)(inf.freemem >> 20));
+    exit(1);
+  }
+}
+
+// grow the heap by several superpage-aligned 2MB stretches,
+// then shrink it by one page (splitting a superpage), and
+// check that the memory survives, including across fork.
+void
+sbrksuper(char *s)
+{
+  char *oldbrk, *top, *p;
+  uint64 a;
+  int pid, xstatus;
+
+  oldbrk = sbrk(0);
+  a = ((uint64)oldbrk + SPGSIZE - 1) & ~(SPGSIZE - 1);
+  top = (char*)a + 3*SPGSIZE;
+  if(sbrk(top - oldbrk) != oldbrk){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(p = (char*)a; p < top; p += PGSIZE)
+    *p = (p - (char*)a) / PGSIZE;
+
+  // give back the last page; the last superpage must be split.
+  if(sbrk(-PGSIZE) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk could not deallocate\n", s);
+    exit(1);
+  }
+  top -= PGSIZE;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  for(p = (char*)a; p < top; p += PGSIZE){
+    if(*p != (char)((p - (char*)a) / PGSIZE)){
+      printf("%s: wrong content at %p in %s\n", s, p, pid == 0 ? "child" : "parent");
+      exit(1);
+    }
+  }
+  if(pid == 0)
+    exit(0);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+
+  if(sbrk(-(sbrk(0) - oldbrk)) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk downsize failed\n", s);
+    exit(1);
+  }
+}
+
+// initialized data spread over pages that nothing touches
+// before the test does; exec() leaves them to be read in on
+// first touch.
+static char lazydata[4*4096] = { [0] = 'a', [4096] = 'b', [8192] = 'c', [12288] = 'd' };
+
+// are demand-loaded pages right when first touched by the
+// kernel (write()), by a fork()ed child, and by the program?
+void
+demandpage(char *s)
+{
+  int fds[2], pid, xstatus;
+  char c;
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], &lazydata[8192], 1) != 1 || read(fds[0], &c, 1) != 1 || c != 'c'){
+    printf("%s: write() from an untouched page failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(lazydata[4096] != 'b' || lazydata[12288] != 'd')
+      exit(1);
+    lazydata[4096] = 'x';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong data\n", s);
+    exit(1);
+  }
+  if(lazydata[0] != 'a' || lazydata[4096] != 'b'){
+    printf("%s: parent saw wrong data\n", s);
+    exit(1);
+  }
+}
+
+// check that writes to the text segment fault, since its
+// pages are shared with other processes running usertests.
+void
+textwrite(char *s)
+{
+  int pid;
+  int xstatus;
+
+  pid = fork();
+  if(pid == 0){
+    volatile int *addr = (int *) 0;
+    *addr = 10;
+    exit(1);
+  } else if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus == -1)  // kernel killed child?
+    exit(0);
+  else
+    exit(xstatus);
+}
+
+// mmap() a file shared and private, and anonymous memory;
+// is a fork()ed child's view right, and does the file end
+// up with the shared writes, and only those?
+void
+mmaptest(char *s)
+{
+  char *file = "mmaptest.tmp";
+  static char buf[3*PGSIZE/2];
+  char *sh, *pr, *an;
+  int fd, i, pid, xstatus;
+
+  fd = open(file, O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = 'a' + i % 26;
+  if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+
+  sh = mmap(0, sizeof(buf), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  pr = mmap(0, sizeof(buf), PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  an = mmap(0, 2*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(sh == MAP_FAILED || pr == MAP_FAILED || an == MAP_FAILED){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < sizeof(buf); i++){
+    if(sh[i] != buf[i] || pr[i] != buf[i]){
+      printf("%s: mapped file reads wrong at %d\n", s, i);
+      exit(1);
+    }
+  }
+  if(sh[sizeof(buf)] != 0 || an[PGSIZE] != 0){
+    printf("%s: mapping not zero-filled\n", s);
+    exit(1);
+  }
+  pr[0] = 'P';
+  sh[PGSIZE] = 'S';
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(pr[0] != 'P' || sh[PGSIZE] != 'S')
+      exit(1);
+    pr[1] = 'Q';     // private: the parent mustn't see this
+    sh[1] = 'T';     // shared: the parent and the file should
+    an[0] = 'U';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong data\n", s);
+    exit(1);
+  }
+  if(pr[1] != buf[1] || sh[1] != 'T' || an[0] != 'U'){
+    printf("%s: parent saw wrong data\n", s);
+    exit(1);
+  }
+
+  if(munmap(sh, sizeof(buf)) < 0 || munmap(pr, PGSIZE) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  if(pr[PGSIZE] != buf[PGSIZE]){
+    printf("%s: partial munmap lost the rest\n", s);
+    exit(1);
+  }
+  fd = open(file, O_RDONLY);
+  if(fd < 0 || read(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: reading back failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink(file);
+  if(buf[0] != 'a' || buf[1] != 'T' || buf[PGSIZE] != 'S'){
+    printf("%s: file has wrong data after munmap\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid == 0){
+    sh[0] = 'x';     // unmapped, so the kernel should kill us
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: store to unmapped region didn't fault\n", s);
+    exit(1);
+  }
+
+  // a length that wraps when rounded up to a page.
+  if(mmap(0, -1L, PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0) != MAP_FAILED){
+    printf("%s: mmap of 2^64-1 bytes succeeded\n", s);
+    exit(1);
+  }
+}
+
 // can we read the kernel's memory?
 void
 kernmem(char *s)
@@ -2666,11 +3398,22 @@ main(int argc, char *argv[])
     {fourfiles, "fourfiles"},
     {sharedfd, "sharedfd"},
     {exectest, "exectest"},
+    {spawntest, "spawntest"},
+    {vforktest, "vforktest"},
     {bigargtest, "bigargtest"},
     {bigwrite, "bigwrite"},
     {bsstest, "bsstest"},
     {sbrkbasic, "sbrkbasic"},
     {sbrkmuch, "sbrkmuch"},
+    {kvmsuper, "kvmsuper"},
+    {sbrksuper, "sbrksuper"},
+    {swapout, "swapout"},
+    {zramtest, "zramtest"},
+    {ksmtest, "ksmtest"},
+    {threadtest, "threadtest"},
+    {demandpage, "demandpage"},
+    {textwrite, "textwrite"},
+    {mmaptest, "mmaptest"},
     {kernmem, "kernmem"},
     {sbrkfail, "sbrkfail"},
     {sbrkarg, "sbrkarg"},
@@ -2693,6 +3436,10 @@ main(int argc, char *argv[])
     {dirfile, "dirfile"},
     {iref, "iref"},
     {forktest, "forktest"},
+    {manyprocs, "manyprocs"},
+    {affinitytest, "affinitytest"},
+    {nanosleeptest, "nanosleeptest"},
+    {clocktest, "clocktest"},
     {bigdir, "bigdir"}, // slow
     { 0, 0},
   };
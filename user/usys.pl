@@ -38,3 +38,16 @@ entry("sleep");
 entry("uptime");
 entry("trace"); # Add
 entry("sysinfo"); # Add
+entry("mmap");
+entry("munmap");
+entry("clone");
+entry("join");
+entry("futex");
+entry("spawn");
+entry("vfork");
+entry("settickets");
+entry("getticks");
+entry("sched_setaffinity");
+entry("sched_getaffinity");
+entry("nanosleep");
+entry("uptimens");
@@ -0,0 +1,81 @@
+// Process creation benchmark: vfork() + exec() against
+// fork() + exec().
+//
+// Starts a program that exits at once, n times each way, from
+// a parent with heaps of 0 KB up to the given size, doubling
+// from 256 KB. fork() must copy the parent's page table, so
+// its cost grows with the heap; vfork() lends the child the
+// parent's, so its cost shouldn't. The program is this one,
+// run with argument "-x".
+//
+// usage: vforkbench [iterations [max heap KB]]
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+char *args[] = { "vforkbench", "-x", 0 };
+
+// report the rate, given the time taken in nanoseconds.
+void
+report(char *what, int kb, int n, uint64 ns)
+{
+  printf("%s, %d KB: %d in %d ms, %d/s\n", what, kb, n, (int)(ns / 1000000),
+         (int)(n * 1000000000L / (ns ? ns : 1)));
+}
+
+// Start and reap n children with fork(), or vfork() if v.
+void
+run(int v, int n, int kb)
+{
+  int i, pid;
+  uint64 t0;
+
+  t0 = uptimens();
+  for(i = 0; i < n; i++){
+    pid = v ? vfork() : fork();
+    if(pid < 0){
+      fprintf(2, "vforkbench: %s failed\n", v ? "vfork" : "fork");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(args[0], args);
+      exit(1);
+    }
+    wait(0);
+  }
+  report(v ? "vfork+exec" : "fork+exec", kb, n, uptimens() - t0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 200, max = 8192;
+  int kb, have = 0, i;
+  char *heap;
+
+  if(argc > 1 && strcmp(argv[1], "-x") == 0)
+    exit(0);
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(argc > 2)
+    max = atoi(argv[2]);
+  if(n <= 0 || max < 0){
+    fprintf(2, "usage: vforkbench [iterations [max heap KB]]\n");
+    exit(1);
+  }
+
+  for(kb = 0; kb <= max; kb = kb ? kb * 2 : 256){
+    heap = sbrk((kb - have) * 1024);
+    if(heap == (char*)-1){
+      fprintf(2, "vforkbench: sbrk failed\n");
+      exit(1);
+    }
+    for(i = 0; i < (kb - have) * 1024; i += PGSIZE)
+      heap[i] = 1;
+    have = kb;
+    run(0, n, kb);
+    run(1, n, kb);
+  }
+  exit(0);
+}
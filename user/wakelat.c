@@ -0,0 +1,129 @@
+// Wakeup latency: how long a process that is woken waits
+// before it runs.
+//
+// The process sleeps with nanosleep() over and over, and notes
+// how long after its deadline it got back, which is mostly how
+// long it waited, once woken, for a hart. It and the load all
+// run on hart 0: s processes that spin, and one that forks a
+// child with a heap of k KB over and over, so that the kernel
+// spends long stretches copying and freeing memory with a
+// spinlock held (see preempt() in proc.c). Prints percentiles
+// and the worst case. make TICK= shortens the wait for a tick.
+//
+// usage: wakelat [rounds [spinners [fork KB]]]
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/timepage.h"
+#include "user/user.h"
+
+#define MAXSPIN 16
+#define MAXROUNDS 1000
+
+// how long each wakeup waited, in microseconds.
+int late[MAXROUNDS];
+
+uint64
+now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.sec * 1000000000 + ts.nsec;
+}
+
+// the p'th percentile of the sorted a[0..n-1].
+int
+pct(int *a, int n, int p)
+{
+  int i = n * p / 100;
+
+  return a[i < n ? i : n - 1];
+}
+
+void
+spin(void)
+{
+  volatile uint64 x = 0;
+
+  for(;;)
+    x++;
+}
+
+// fork children with a kb KB heap, which exit at once.
+void
+forker(int kb)
+{
+  char *heap;
+  int i, pid;
+
+  if((heap = sbrk(kb * 1024)) == (char*)-1){
+    fprintf(2, "wakelat: sbrk failed\n");
+    exit(1);
+  }
+  for(i = 0; i < kb * 1024; i += PGSIZE)
+    heap[i] = 1;
+  for(;;){
+    if((pid = fork()) < 0)
+      continue;
+    if(pid == 0)
+      exit(0);
+    wait(0);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int rounds = 200, nspin = 1, kb = 4096;
+  int load[MAXSPIN + 1], nload = 0, i, j, n, v;
+  uint64 t;
+
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(argc > 2)
+    nspin = atoi(argv[2]);
+  if(argc > 3)
+    kb = atoi(argv[3]);
+  if(rounds < 1 || rounds > MAXROUNDS || nspin < 0 || nspin > MAXSPIN || kb < 0){
+    fprintf(2, "usage: wakelat [rounds [spinners [fork KB]]]\n");
+    exit(1);
+  }
+
+  // the children inherit it.
+  if(sched_setaffinity(0, 1 << 0) < 0){
+    fprintf(2, "wakelat: sched_setaffinity failed\n");
+    exit(1);
+  }
+  for(i = 0; i < nspin + (kb > 0); i++){
+    if((load[nload] = fork()) < 0){
+      fprintf(2, "wakelat: fork failed\n");
+      exit(1);
+    }
+    if(load[nload] == 0){
+      if(i < nspin)
+        spin();
+      forker(kb);
+    }
+    nload++;
+  }
+
+  for(n = 0; n < rounds; n++){
+    t = now();
+    nanosleep(5000000);
+    t = now() - t;
+    v = t > 5000000 ? (t - 5000000) / 1000 : 0;
+    // insertion sort as they come.
+    for(j = n; j > 0 && late[j-1] > v; j--)
+      late[j] = late[j-1];
+    late[j] = v;
+  }
+  printf("wakelat: %d wakeups, us late: p50 %d p90 %d p99 %d max %d\n",
+         n, pct(late, n, 50), pct(late, n, 90), pct(late, n, 99), late[n-1]);
+
+  for(i = 0; i < nload; i++)
+    kill(load[i]);
+  for(i = 0; i < nload; i++)
+    wait(0);
+  exit(0);
+}